@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Placement of the worker threads of an Arbor context on the CPUs of the
+// host, and of their memory on NUMA nodes, on Linux.
+//
+// Arbor creates its thread pool inside make_context, without a hook for
+// thread start-up, so threads are bound from the outside: the calling thread
+// is bound and given its memory policy before the context is made, which the
+// new threads inherit, and afterwards each new thread found in
+// /proc/self/task is bound to its own CPU set. The calling thread takes part
+// in the pool as thread 0. Since the cell groups are built in parallel by
+// the pool, first-touch allocation then puts each thread's model state on
+// its local NUMA node.
+
+// The CPUs this process may run on, with their socket, core and NUMA node
+// as reported by sysfs (0 where not reported).
+struct cpu_topology {
+    struct cpu {
+        int id;
+        int socket;
+        int core;
+        int node;
+    };
+    std::vector<cpu> cpus;
+
+    std::size_t num_sockets() const { return count([](const cpu& c) { return c.socket; }); }
+    std::size_t num_nodes() const { return count([](const cpu& c) { return c.node; }); }
+    std::size_t num_cores() const {
+        std::set<std::pair<int, int>> cores;
+        for (auto& c: cpus) cores.insert({c.socket, c.core});
+        return cores.size();
+    }
+
+private:
+    template <typename F>
+    std::size_t count(F key) const {
+        std::set<int> keys;
+        for (auto& c: cpus) keys.insert(key(c));
+        return keys.size();
+    }
+};
+
+namespace impl {
+
+inline int read_sysfs_int(const std::string& path, int fallback = 0) {
+    std::ifstream f(path);
+    int x;
+    return f >> x? x: fallback;
+}
+
+// Parse a sysfs cpu list such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        auto dash = range.find('-');
+        int lo = std::stoi(range.substr(0, dash));
+        int hi = dash==std::string::npos? lo: std::stoi(range.substr(dash+1));
+        for (int i=lo; i<=hi; ++i) ids.push_back(i);
+    }
+    return ids;
+}
+
+inline std::vector<std::string> list_dir(const std::string& path) {
+    std::vector<std::string> names;
+    if (DIR* d = ::opendir(path.c_str())) {
+        while (auto e = ::readdir(d)) names.push_back(e->d_name);
+        ::closedir(d);
+    }
+    return names;
+}
+
+// Thread ids of this process.
+inline std::set<pid_t> list_tasks() {
+    std::set<pid_t> tids;
+    for (auto& name: list_dir("/proc/self/task")) {
+        if (!name.empty() && name.find_first_not_of("0123456789")==std::string::npos) {
+            tids.insert(std::atoi(name.c_str()));
+        }
+    }
+    return tids;
+}
+
+} // namespace impl
+
+inline cpu_topology read_topology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        throw std::runtime_error("affinity: unable to query the CPUs of the process");
+    }
+
+    std::map<int, int> node_of;
+    for (auto& name: impl::list_dir("/sys/devices/system/node")) {
+        if (name.compare(0, 4, "node") || name.size()==4) continue;
+        int node = std::atoi(name.c_str()+4);
+        std::ifstream f("/sys/devices/system/node/"+name+"/cpulist");
+        std::string list;
+        std::getline(f, list);
+        for (int id: impl::parse_cpu_list(list)) node_of[id] = node;
+    }
+
+    cpu_topology topo;
+    for (int id=0; id<CPU_SETSIZE; ++id) {
+        if (!CPU_ISSET(id, &allowed)) continue;
+        std::string dir = "/sys/devices/system/cpu/cpu"+std::to_string(id)+"/topology/";
+        topo.cpus.push_back({
+            id,
+            impl::read_sysfs_int(dir+"physical_package_id"),
+            impl::read_sysfs_int(dir+"core_id"),
+            node_of.count(id)? node_of[id]: 0});
+    }
+    return topo;
+}
+
+// Part i of k disjoint parts of a topology, for contexts that run side by
+// side: whole cores in socket order, so that the hardware threads of a core
+// stay together. With fewer cores than parts, parts share cores.
+inline cpu_topology partition_topology(const cpu_topology& topo, unsigned i, unsigned k) {
+    std::vector<std::pair<int, int>> cores;
+    for (auto& c: topo.cpus) cores.push_back({c.socket, c.core});
+    std::sort(cores.begin(), cores.end());
+    cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+    if (cores.empty() || k<2) return topo;
+
+    std::size_t lo = cores.size()*i/k, hi = cores.size()*(i+1)/k;
+    if (lo==hi) {
+        lo = i%cores.size();
+        hi = lo+1;
+    }
+
+    cpu_topology part;
+    for (auto& c: topo.cpus) {
+        std::size_t pos = std::lower_bound(cores.begin(), cores.end(), std::make_pair(c.socket, c.core))-cores.begin();
+        if (pos>=lo && pos<hi) part.cpus.push_back(c);
+    }
+    return part;
+}
+
+// Binds the threads of one context according to a mode:
+//
+//   none       leave placement to the OS;
+//   cores      each thread to one physical core, filling sockets in order,
+//              then the remaining hardware threads of each core;
+//   sockets    threads round-robin over sockets, each free to move among
+//              the CPUs of its socket.
+//
+// and sets the memory policy of all threads to one of
+//
+//   default    leave the inherited policy;
+//   local      allocate on the node of the allocating thread;
+//   interleave spread pages round-robin over all nodes.
+class thread_binding {
+public:
+    // To be constructed immediately before make_context.
+    thread_binding(std::string bind, std::string numa, unsigned num_threads, const cpu_topology& topo):
+        bind_(std::move(bind)), numa_(std::move(numa)), topo_(topo)
+    {
+        if (bind_!="none" && bind_!="cores" && bind_!="sockets") {
+            throw std::runtime_error("Unknown thread binding: "+bind_);
+        }
+        if (numa_!="default" && numa_!="local" && numa_!="interleave") {
+            throw std::runtime_error("Unknown NUMA policy: "+numa_);
+        }
+
+        set_memory_policy();
+
+        if (bind_!="none" && !topo_.cpus.empty()) {
+            sets_ = thread_cpu_sets(num_threads);
+            before_ = impl::list_tasks();
+            pin(0, sets_[0]);
+        }
+        threads_.push_back(::syscall(SYS_gettid));
+    }
+
+    // To be called immediately after make_context: bind the new threads.
+    void bind_new_threads() {
+        if (sets_.empty()) return;
+        for (pid_t tid: impl::list_tasks()) {
+            if (before_.count(tid)) continue;
+            pin(tid, sets_[threads_.size()%sets_.size()]);
+            threads_.push_back(tid);
+        }
+    }
+
+    // Bind the calling thread as thread 0 instead, for a context that is
+    // driven by another thread than the one that made it.
+    void bind_calling_thread() {
+        threads_[0] = ::syscall(SYS_gettid);
+        if (!sets_.empty()) pin(0, sets_[0]);
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const thread_binding& b) {
+        const auto& t = b.topo_;
+        o << "topology: " << t.num_sockets() << " sockets, " << t.num_cores() << " cores, "
+          << t.cpus.size() << " cpus, " << t.num_nodes() << " numa nodes\n";
+        o << "binding:  " << b.bind_ << ", memory " << b.numa_ << "\n";
+        for (std::size_t i=0; i<b.threads_.size() && !b.sets_.empty(); ++i) {
+            const auto& set = b.sets_[i%b.sets_.size()];
+            o << "  thread " << i << " (tid " << b.threads_[i] << ") -> cpus";
+            for (auto& c: t.cpus) {
+                if (CPU_ISSET(c.id, &set)) o << " " << c.id;
+            }
+            o << "\n";
+        }
+        return o;
+    }
+
+private:
+    std::string bind_, numa_;
+    cpu_topology topo_;
+    std::vector<cpu_set_t> sets_;
+    std::set<pid_t> before_;
+    std::vector<pid_t> threads_;
+
+    std::vector<cpu_set_t> thread_cpu_sets(unsigned num_threads) const {
+        std::vector<cpu_set_t> sets;
+        auto cpus = topo_.cpus;
+
+        if (bind_=="cores") {
+            // First hardware thread of every core, then the second, ...
+            std::stable_sort(cpus.begin(), cpus.end(), [](const cpu_topology::cpu& a, const cpu_topology::cpu& b) {
+                return a.socket<b.socket || (a.socket==b.socket && a.core<b.core);
+            });
+            std::map<std::pair<int, int>, int> seen;
+            std::vector<std::pair<int, int>> order;   // (rank within core, position)
+            for (std::size_t i=0; i<cpus.size(); ++i) {
+                order.push_back({seen[{cpus[i].socket, cpus[i].core}]++, int(i)});
+            }
+            std::stable_sort(order.begin(), order.end(),
+                [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first<b.first; });
+
+            for (unsigned i=0; i<num_threads; ++i) {
+                cpu_set_t s;
+                CPU_ZERO(&s);
+                CPU_SET(cpus[order[i%order.size()].second].id, &s);
+                sets.push_back(s);
+            }
+        }
+        else {
+            std::vector<int> sockets;
+            for (auto& c: cpus) sockets.push_back(c.socket);
+            std::sort(sockets.begin(), sockets.end());
+            sockets.erase(std::unique(sockets.begin(), sockets.end()), sockets.end());
+
+            for (unsigned i=0; i<num_threads; ++i) {
+                cpu_set_t s;
+                CPU_ZERO(&s);
+                for (auto& c: cpus) {
+                    if (c.socket==sockets[i%sockets.size()]) CPU_SET(c.id, &s);
+                }
+                sets.push_back(s);
+            }
+        }
+        return sets;
+    }
+
+    static void pin(pid_t tid, const cpu_set_t& set) {
+        if (::sched_setaffinity(tid, sizeof(set), &set)) {
+            throw std::runtime_error("affinity: unable to bind thread "+std::to_string(tid));
+        }
+    }
+
+    // Memory policy of the calling thread, inherited by the threads it creates.
+    void set_memory_policy() const {
+        // Values from <linux/mempolicy.h>.
+        constexpr int mpol_interleave = 3;
+        constexpr int mpol_local = 4;
+
+        if (numa_=="local") {
+            if (::syscall(SYS_set_mempolicy, mpol_local, nullptr, 0)) {
+                throw std::runtime_error("affinity: unable to set local memory policy");
+            }
+        }
+        else if (numa_=="interleave") {
+            constexpr unsigned long bits = 8*sizeof(unsigned long);
+            unsigned long mask[16] = {};
+            for (auto& c: topo_.cpus) {
+                if (unsigned(c.node)<16*bits) mask[c.node/bits] |= 1ul<<(c.node%bits);
+            }
+            if (::syscall(SYS_set_mempolicy, mpol_interleave, mask, 16*bits)) {
+                throw std::runtime_error("affinity: unable to set interleaved memory policy");
+            }
+        }
+    }
+};
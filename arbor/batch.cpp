@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+#include "affinity.hpp"
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+#include "streaming_features.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double seconds_since(clock_type::time_point t) {
+    return std::chrono::duration<double>(clock_type::now()-t).count();
+}
+
+// Simulated time of each calibration run [ms].
+constexpr double calibration_time = 10;
+
+struct batch_case {
+    std::size_t index;      // Position among the parameter files.
+    std::string file;
+    single_params params;
+};
+
+using case_list = std::vector<const batch_case*>;
+
+bool same_inputs(const single_params& p, const single_params& q) {
+    if (p.input_file!=q.input_file || p.inputs.size()!=q.inputs.size()) return false;
+    for (std::size_t i=0; i<p.inputs.size(); ++i) {
+        const auto& a = p.inputs[i];
+        const auto& b = q.inputs[i];
+        if (a.type!=b.type || a.target!=b.target || a.rate!=b.rate || a.start!=b.start ||
+            a.stop!=b.stop || a.seed!=b.seed || a.weight!=b.weight) return false;
+    }
+    return true;
+}
+
+// Cases can share one simulation if the global properties, the time step,
+// the stop time and the inputs agree. Every case gets the inputs it would
+// get as gid 0 of a run of its own.
+bool can_batch(const case_list& cases) {
+    for (auto c: cases) {
+        const auto& p = c->params;
+        const auto& q = cases.front()->params;
+        if (p.temp!=q.temp || p.v_init!=q.v_init || p.dt!=q.dt || p.tstop!=q.tstop) return false;
+        if (!same_inputs(p, q)) return false;
+    }
+    return true;
+}
+
+// Run cases as the gids of one simulation on a context, to their stop time
+// or tmax if sooner, and return a result record per case.
+std::vector<nlohmann::json> simulate(const arb::context& context, const case_list& cases, double tmax) {
+    std::vector<single_params> params;
+    for (auto c: cases) params.push_back(c->params);
+
+    soma_recipe recipe(params, input_seeding::shared);
+    auto decomp = arb::partition_load_balance(recipe, context);
+    arb::simulation sim(recipe, decomp, context);
+
+    const auto times = input_event_times();
+    std::vector<std::unique_ptr<feature_extractor>> features;
+    for (cell_gid_type gid=0; gid<params.size(); ++gid) {
+        features.emplace_back(new feature_extractor(recipe.event_generators(gid), params[gid].tstop, params[gid].spike_threshold));
+        sim.add_sampler(arb::one_probe({gid, 0}), make_sample_schedule(params[gid], times), features.back()->sampler());
+    }
+
+    std::vector<std::vector<double>> spikes(params.size());
+    sim.set_global_spike_callback(
+        [&spikes](const std::vector<arb::spike>& s) {
+            for (auto& spike: s) spikes[spike.source.gid].push_back(spike.time);
+        });
+
+    sim.run(std::min(tmax, params.front().tstop), params.front().dt);
+
+    std::vector<nlohmann::json> results;
+    for (std::size_t i=0; i<cases.size(); ++i) {
+        nlohmann::json r;
+        r["case"] = cases[i]->index;
+        r["params_file"] = cases[i]->file;
+        r["param_hash"] = params_hash(cases[i]->file);
+        r["spikes"] = spikes[i];
+        r["features"] = features[i]->record();
+        results.push_back(std::move(r));
+    }
+    return results;
+}
+
+// K local contexts on disjoint parts of the host, each with its share of
+// the threads, that run one case at a time side by side.
+class context_pool {
+public:
+    context_pool(unsigned k, unsigned num_threads, const single_options& options, const cpu_topology& topo) {
+        for (unsigned i=0; i<k; ++i) {
+            arb::proc_allocation alloc;
+            alloc.num_threads = num_threads/k + (i<num_threads%k);
+            alloc.gpu_id = -1;
+
+            bindings_.emplace_back(new thread_binding(
+                options.bind, options.numa, alloc.num_threads, partition_topology(topo, i, k)));
+            contexts_.push_back(arb::make_context(alloc));
+            bindings_.back()->bind_new_threads();
+        }
+    }
+
+    // Run every case on the next free context, one driver thread per
+    // context; results are in the order of the cases.
+    std::vector<nlohmann::json> run(const case_list& cases, double tmax) {
+        const std::size_t k = contexts_.size();
+        std::vector<nlohmann::json> results(cases.size());
+        std::vector<std::exception_ptr> errors(k);
+        std::atomic<std::size_t> next(0);
+
+        std::vector<std::thread> drivers;
+        for (std::size_t j=0; j<k; ++j) {
+            drivers.emplace_back([&, j]() {
+                try {
+                    bindings_[j]->bind_calling_thread();
+                    for (std::size_t i; (i = next++)<cases.size();) {
+                        results[i] = simulate(contexts_[j], {cases[i]}, tmax).front();
+                    }
+                }
+                catch (...) {
+                    errors[j] = std::current_exception();
+                }
+            });
+        }
+        for (auto& d: drivers) d.join();
+        for (auto& e: errors) {
+            if (e) std::rethrow_exception(e);
+        }
+        return results;
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const context_pool& p) {
+        for (std::size_t j=0; j<p.contexts_.size(); ++j) {
+            o << "context " << j << ": " << arb::num_threads(p.contexts_[j]) << " threads\n" << *p.bindings_[j];
+        }
+        return o;
+    }
+
+private:
+    std::vector<std::unique_ptr<thread_binding>> bindings_;
+    std::vector<arb::context> contexts_;
+};
+
+} // namespace
+
+int run_batch(const single_options& options, unsigned num_threads, const cpu_topology& topology) {
+    int rank = 0, num_ranks = 1;
+#ifdef ARB_MPI_ENABLED
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+#endif
+    const bool root = rank==0;
+    const auto t_start = clock_type::now();
+
+    std::string results_file = options.results_file.empty()? "batch.jsonl": options.results_file;
+    if (root) {
+        std::ofstream f(results_file, std::ios::trunc);
+        if (!f.good()) {
+            throw std::runtime_error("Unable to open results file: "+results_file);
+        }
+    }
+    barrier();
+
+    // Cases are dealt round-robin to the ranks, each of which runs its own
+    // on local contexts.
+    std::vector<batch_case> cases;
+    for (std::size_t i=rank; i<options.params_files.size(); i+=num_ranks) {
+        const auto& file = options.params_files[i];
+        auto params = read_params(file);
+        if (params.mode!="single") {
+            throw std::runtime_error("batch: only single mode parameter files are supported: "+file);
+        }
+        cases.push_back({i, file, std::move(params)});
+    }
+    if (cases.empty()) {
+        barrier();
+        return 0;
+    }
+
+    case_list all;
+    for (auto& c: cases) all.push_back(&c);
+
+    unsigned k = options.contexts? options.contexts: num_threads;
+    k = std::max(1u, std::min({k, num_threads, unsigned(cases.size())}));
+
+    std::string strategy = options.strategy;
+    if (!can_batch(all)) {
+        if (strategy=="batched") {
+            throw std::runtime_error("batch: cases differ in temp, v_init, dt, tstop or inputs and cannot share a simulation");
+        }
+        strategy = "concurrent";
+    }
+
+    std::unique_ptr<context_pool> pool;
+    if (strategy!="batched") {
+        pool.reset(new context_pool(k, num_threads, options, topology));
+        if (root) std::cout << *pool;
+    }
+
+    std::unique_ptr<thread_binding> binding;
+    arb::context context;
+    if (strategy!="concurrent") {
+        arb::proc_allocation alloc;
+        alloc.num_threads = num_threads;
+        alloc.gpu_id = -1;
+        binding.reset(new thread_binding(options.bind, options.numa, num_threads, topology));
+        context = arb::make_context(alloc);
+        binding->bind_new_threads();
+        if (root) std::cout << "batched context: " << num_threads << " threads\n" << *binding;
+    }
+
+    // Time both on the first cases, enough to give every context two, over a
+    // short interval, and keep the higher rate of simulated case-ms per second.
+    if (strategy=="auto") {
+        case_list sample(all.begin(), all.begin()+std::min<std::size_t>(2*k, all.size()));
+        const double t = std::min(calibration_time, sample.front()->params.tstop);
+        const double work = sample.size()*t;
+
+        auto t0 = clock_type::now();
+        pool->run(sample, t);
+        const double concurrent_rate = work/seconds_since(t0);
+
+        binding->bind_calling_thread();
+        t0 = clock_type::now();
+        simulate(context, sample, t);
+        const double batched_rate = work/seconds_since(t0);
+
+        strategy = batched_rate>=concurrent_rate? "batched": "concurrent";
+        if (root) {
+            std::cout << "calibration over " << sample.size() << " cases of " << t << " ms: "
+                      << "batched " << batched_rate << " case-ms/s, "
+                      << k << " concurrent " << concurrent_rate << " case-ms/s\n";
+        }
+    }
+
+    const auto inf = std::numeric_limits<double>::infinity();
+    const auto t_run = clock_type::now();
+    std::vector<nlohmann::json> results;
+    if (strategy=="batched") {
+        binding->bind_calling_thread();
+        results = simulate(context, all, inf);
+    }
+    else {
+        results = pool->run(all, inf);
+    }
+    const double run_time = seconds_since(t_run);
+
+    double work = 0;
+    for (auto& c: cases) work += c.params.tstop;
+    for (auto& r: results) {
+        r["strategy"] = strategy;
+        append_record(results_file, r);
+    }
+
+    std::cout << "rank " << rank << ": " << cases.size() << " cases " << strategy
+              << (strategy=="concurrent"? " on "+std::to_string(k)+" contexts": "")
+              << " in " << run_time << " s, " << work/run_time << " case-ms/s\n";
+
+    barrier();
+    if (root) {
+        std::cout << options.params_files.size() << " cases in " << seconds_since(t_start)
+                  << " s, results in " << results_file << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+namespace sup {
+
+// A quantity recorded along a cable: a matrix with one row per sample time
+// and one column per position, written row by row as it is sampled.
+//
+// Layout, all little-endian:
+//
+//     magic      "DNDMTX01"
+//     uint64     length of the metadata
+//     metadata   json, zero padded to a multiple of 8 bytes
+//     rows       {float64 time, float32 values[num_positions]}, each zero
+//                padded to a multiple of 8 bytes
+//
+// The metadata holds the positions of the columns (as fractions of the
+// cable length, ascending) and the units. The number of rows follows from
+// the file size, so rows can be appended without revisiting the header.
+// test_single.py writes the same format from NEURON.
+
+constexpr char dendrite_matrix_magic[8] = {'D', 'N', 'D', 'M', 'T', 'X', '0', '1'};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__!=__ORDER_LITTLE_ENDIAN__
+#error "dendrite matrices require a little-endian host"
+#endif
+
+inline std::size_t dendrite_row_bytes(std::size_t num_positions) {
+    return (8+4*num_positions+7)/8*8;
+}
+
+class dendrite_matrix_writer {
+public:
+    dendrite_matrix_writer(const std::string& path, std::vector<double> positions, const std::string& units):
+        positions_(std::move(positions)), row_(dendrite_row_bytes(positions_.size()), 0)
+    {
+        out_.open(path, std::ios::binary);
+        if (!out_.good()) {
+            throw std::runtime_error("Unable to open dendrite matrix file: "+path);
+        }
+
+        nlohmann::json meta;
+        meta["positions"] = positions_;
+        meta["units"] = units;
+        std::string text = meta.dump();
+        text.resize((text.size()+7)/8*8, '\0');
+        std::uint64_t len = text.size();
+
+        out_.write(dendrite_matrix_magic, sizeof(dendrite_matrix_magic));
+        out_.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out_.write(text.data(), text.size());
+    }
+
+    std::size_t num_positions() const { return positions_.size(); }
+
+    // Append the row of values at time t, one per position.
+    template <typename T>
+    void append(double t, const T* values) {
+        std::memcpy(&row_[0], &t, sizeof(t));
+        float* v = reinterpret_cast<float*>(&row_[8]);
+        for (std::size_t i=0; i<positions_.size(); ++i) v[i] = values[i];
+        out_.write(row_.data(), row_.size());
+    }
+
+    void close() {
+        out_.close();
+        if (out_.fail()) {
+            throw std::runtime_error("Unable to write dendrite matrix file");
+        }
+    }
+
+private:
+    std::ofstream out_;
+    std::vector<double> positions_;
+    std::vector<char> row_;
+};
+
+// Read-only memory map of a dendrite matrix.
+class mapped_dendrite_matrix {
+public:
+    explicit mapped_dendrite_matrix(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd<0) {
+            throw std::runtime_error("Unable to open dendrite matrix file: "+path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) || st.st_size<16) {
+            ::close(fd);
+            throw std::runtime_error("dendrite matrix: truncated file: "+path);
+        }
+        size_ = st.st_size;
+        void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p==MAP_FAILED) {
+            throw std::runtime_error("dendrite matrix: unable to map file: "+path);
+        }
+        data_ = static_cast<const char*>(p);
+
+        try {
+            if (std::memcmp(data_, dendrite_matrix_magic, sizeof(dendrite_matrix_magic))) {
+                throw std::runtime_error("dendrite matrix: bad magic: "+path);
+            }
+            std::uint64_t len;
+            std::memcpy(&len, data_+8, sizeof(len));
+            if (len%8 || len>size_-16) {
+                throw std::runtime_error("dendrite matrix: bad metadata: "+path);
+            }
+            std::string text(data_+16, len);
+            auto meta = nlohmann::json::parse(text.c_str());
+            positions_ = meta.at("positions").get<std::vector<double>>();
+            units_ = meta.at("units").get<std::string>();
+
+            rows_ = data_+16+len;
+            row_bytes_ = dendrite_row_bytes(positions_.size());
+            num_times_ = (size_-16-len)/row_bytes_;
+        }
+        catch (...) {
+            ::munmap(const_cast<char*>(data_), size_);
+            throw;
+        }
+    }
+
+    mapped_dendrite_matrix(const mapped_dendrite_matrix&) = delete;
+    mapped_dendrite_matrix& operator=(const mapped_dendrite_matrix&) = delete;
+
+    ~mapped_dendrite_matrix() {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    std::size_t num_times() const { return num_times_; }
+    std::size_t num_positions() const { return positions_.size(); }
+    const std::vector<double>& positions() const { return positions_; }
+    const std::string& units() const { return units_; }
+
+    double time(std::size_t k) const {
+        double t;
+        std::memcpy(&t, rows_+k*row_bytes_, sizeof(t));
+        return t;
+    }
+
+    // The values of row k, one per position; rows are 8-byte aligned.
+    const float* row(std::size_t k) const {
+        return reinterpret_cast<const float*>(rows_+k*row_bytes_+8);
+    }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    std::vector<double> positions_;
+    std::string units_;
+    const char* rows_ = nullptr;
+    std::size_t row_bytes_ = 0;
+    std::size_t num_times_ = 0;
+};
+
+} // namespace sup
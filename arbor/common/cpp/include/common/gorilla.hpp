@@ -0,0 +1,349 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace sup {
+
+// Lossless compression of (time, value) traces of doubles after Pelkonen et
+// al., "Gorilla: a fast, scalable, in-memory time series database" (2015).
+//
+// File layout: the 8 byte magic "GRLTRC01", followed by independently
+// decodable blocks. Each block has a 24 byte header
+//
+//     uint32   number of samples n
+//     uint32   payload size in bytes
+//     float64  time of first sample
+//     float64  time of last sample
+//
+// (all little-endian) followed by the bit stream payload, in which the first
+// sample is stored verbatim and each following sample as:
+//
+//   * time: the delta-of-delta of the IEEE bit patterns of successive times,
+//     which is zero or tiny for a regular sampling schedule:
+//         '0'                       dod == 0
+//         '10'   + 7 bits           dod in [-64, 63]
+//         '110'  + 9 bits           dod in [-256, 255]
+//         '1110' + 12 bits          dod in [-2048, 2047]
+//         '1111' + 64 bits          otherwise
+//   * value: the XOR with the previous value, which for slowly varying
+//     potentials has many leading and trailing zero bits:
+//         '0'                       identical value
+//         '10'   + meaningful bits  within the previous leading/trailing window
+//         '11'   + 5 bits leading zeros + 6 bits (length-1) + meaningful bits
+//
+// The block headers allow a reader to skip blocks outside a time window.
+
+constexpr char gorilla_magic[8] = {'G', 'R', 'L', 'T', 'R', 'C', '0', '1'};
+constexpr std::size_t gorilla_block_header_size = 24;
+
+namespace impl {
+
+inline std::uint64_t to_bits(double x) {
+    std::uint64_t u;
+    std::memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+inline double from_bits(std::uint64_t u) {
+    double x;
+    std::memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+inline void put_le(std::vector<unsigned char>& buf, std::uint64_t x, unsigned nbytes) {
+    for (unsigned i=0; i<nbytes; ++i) buf.push_back((x>>(8*i))&0xff);
+}
+
+inline std::uint64_t get_le(const unsigned char* p, unsigned nbytes) {
+    std::uint64_t x = 0;
+    for (unsigned i=0; i<nbytes; ++i) x |= std::uint64_t(p[i])<<(8*i);
+    return x;
+}
+
+// Appends bits most significant first, via a 64-bit accumulator.
+class bit_writer {
+public:
+    explicit bit_writer(std::vector<unsigned char>& buf): buf_(buf) {}
+
+    // Write the low n bits of x, 1 <= n <= 64.
+    void write(std::uint64_t x, unsigned n) {
+        if (n<64) x &= (std::uint64_t(1)<<n)-1;
+
+        unsigned space = 64-used_;
+        if (n<space) {
+            acc_ = (acc_<<n) | x;
+            used_ += n;
+        }
+        else {
+            unsigned rest = n-space;
+            acc_ = space==64? x>>rest: (acc_<<space) | (x>>rest);
+            put_word();
+            acc_ = rest? x & ((std::uint64_t(1)<<rest)-1): 0;
+            used_ = rest;
+        }
+    }
+
+    // Flush remaining bits, zero padded to a whole byte.
+    void finish() {
+        if (!used_) return;
+        std::uint64_t w = acc_<<(64-used_);
+        for (unsigned i=0; i<(used_+7)/8; ++i) buf_.push_back((w>>(56-8*i))&0xff);
+        acc_ = 0;
+        used_ = 0;
+    }
+
+private:
+    std::vector<unsigned char>& buf_;
+    std::uint64_t acc_ = 0;
+    unsigned used_ = 0;
+
+    void put_word() {
+        for (unsigned i=0; i<8; ++i) buf_.push_back((acc_>>(56-8*i))&0xff);
+    }
+};
+
+class bit_reader {
+public:
+    bit_reader(const unsigned char* p, std::size_t n): p_(p), end_(p+n) {}
+
+    // Read n bits, 1 <= n <= 64.
+    std::uint64_t read(unsigned n) {
+        std::uint64_t x = 0;
+        while (n) {
+            if (!avail_) {
+                if (p_==end_) throw std::runtime_error("gorilla: truncated block");
+                cur_ = *p_++;
+                avail_ = 8;
+            }
+            unsigned take = n<avail_? n: avail_;
+            x = (x<<take) | ((cur_>>(avail_-take)) & ((1u<<take)-1));
+            avail_ -= take;
+            n -= take;
+        }
+        return x;
+    }
+
+    bool bit() { return read(1); }
+
+private:
+    const unsigned char* p_;
+    const unsigned char* end_;
+    unsigned cur_ = 0;
+    unsigned avail_ = 0;
+};
+
+inline std::int64_t sign_extend(std::uint64_t x, unsigned n) {
+    std::uint64_t m = std::uint64_t(1)<<(n-1);
+    return std::int64_t((x^m)-m);
+}
+
+} // namespace impl
+
+// Streaming encoder: samples are appended one at a time, and each block is
+// written to the output stream as soon as it is full.
+class gorilla_encoder {
+public:
+    explicit gorilla_encoder(std::ostream& out, std::size_t block_size = 4096):
+        out_(out), block_size_(block_size), bits_(payload_)
+    {
+        out_.write(gorilla_magic, sizeof(gorilla_magic));
+        bytes_written_ = sizeof(gorilla_magic);
+    }
+
+    void append(double t, double v) {
+        std::uint64_t tb = impl::to_bits(t);
+        std::uint64_t vb = impl::to_bits(v);
+
+        if (n_==0) {
+            bits_.write(tb, 64);
+            bits_.write(vb, 64);
+            t_first_ = t;
+            delta_ = 0;
+            lead_ = ~0u;
+        }
+        else {
+            std::int64_t delta = std::int64_t(tb-tb_);
+            std::int64_t dod = delta-delta_;
+            delta_ = delta;
+
+            if (dod==0) {
+                bits_.write(0, 1);
+            }
+            else if (dod>=-64 && dod<64) {
+                bits_.write(0b10, 2);
+                bits_.write(dod, 7);
+            }
+            else if (dod>=-256 && dod<256) {
+                bits_.write(0b110, 3);
+                bits_.write(dod, 9);
+            }
+            else if (dod>=-2048 && dod<2048) {
+                bits_.write(0b1110, 4);
+                bits_.write(dod, 12);
+            }
+            else {
+                bits_.write(0b1111, 4);
+                bits_.write(dod, 64);
+            }
+
+            std::uint64_t x = vb^vb_;
+            if (x==0) {
+                bits_.write(0, 1);
+            }
+            else {
+                unsigned lead = __builtin_clzll(x);
+                unsigned trail = __builtin_ctzll(x);
+                if (lead>31) lead = 31;
+
+                if (lead_!=~0u && lead>=lead_ && trail>=trail_) {
+                    bits_.write(0b10, 2);
+                    bits_.write(x>>trail_, 64-lead_-trail_);
+                }
+                else {
+                    unsigned len = 64-lead-trail;
+                    bits_.write(0b11, 2);
+                    bits_.write(lead, 5);
+                    bits_.write(len-1, 6);
+                    bits_.write(x>>trail, len);
+                    lead_ = lead;
+                    trail_ = trail;
+                }
+            }
+        }
+
+        tb_ = tb;
+        vb_ = vb;
+        t_last_ = t;
+        if (++n_==block_size_) flush();
+    }
+
+    // Write out the current, possibly partial, block.
+    void flush() {
+        if (!n_) return;
+        bits_.finish();
+
+        std::vector<unsigned char> header;
+        impl::put_le(header, n_, 4);
+        impl::put_le(header, payload_.size(), 4);
+        impl::put_le(header, impl::to_bits(t_first_), 8);
+        impl::put_le(header, impl::to_bits(t_last_), 8);
+
+        out_.write(reinterpret_cast<const char*>(header.data()), header.size());
+        out_.write(reinterpret_cast<const char*>(payload_.data()), payload_.size());
+        out_.flush();
+        bytes_written_ += header.size()+payload_.size();
+
+        payload_.clear();
+        n_ = 0;
+    }
+
+    std::size_t bytes_written() const { return bytes_written_; }
+
+private:
+    std::ostream& out_;
+    std::size_t block_size_;
+    std::size_t bytes_written_ = 0;
+
+    std::vector<unsigned char> payload_;
+    impl::bit_writer bits_;
+    std::size_t n_ = 0;
+    double t_first_ = 0, t_last_ = 0;
+
+    std::uint64_t tb_ = 0, vb_ = 0;
+    std::int64_t delta_ = 0;
+    unsigned lead_ = ~0u, trail_ = 0;
+};
+
+// Decode a gorilla trace held in memory, calling f(t, v) for each sample with
+// time in [t0, t1). Blocks that lie entirely outside the window are skipped.
+template <typename F>
+void gorilla_decode(const unsigned char* data, std::size_t size, F&& f,
+                    double t0 = -INFINITY, double t1 = INFINITY)
+{
+    if (size<sizeof(gorilla_magic) || std::memcmp(data, gorilla_magic, sizeof(gorilla_magic))) {
+        throw std::runtime_error("gorilla: bad magic");
+    }
+
+    const unsigned char* p = data+sizeof(gorilla_magic);
+    const unsigned char* end = data+size;
+
+    while (p<end) {
+        if (std::size_t(end-p)<gorilla_block_header_size) throw std::runtime_error("gorilla: truncated header");
+        std::size_t n = impl::get_le(p, 4);
+        std::size_t nbytes = impl::get_le(p+4, 4);
+        double t_first = impl::from_bits(impl::get_le(p+8, 8));
+        double t_last = impl::from_bits(impl::get_le(p+16, 8));
+        p += gorilla_block_header_size;
+        if (std::size_t(end-p)<nbytes) throw std::runtime_error("gorilla: truncated block");
+
+        if (t_last<t0 || t_first>=t1) {
+            p += nbytes;
+            continue;
+        }
+
+        impl::bit_reader bits(p, nbytes);
+        std::uint64_t tb = bits.read(64);
+        std::uint64_t vb = bits.read(64);
+        std::int64_t delta = 0;
+        unsigned lead = 0, trail = 0;
+
+        auto emit = [&]() {
+            double t = impl::from_bits(tb);
+            if (t>=t0 && t<t1) f(t, impl::from_bits(vb));
+        };
+        emit();
+
+        for (std::size_t i=1; i<n; ++i) {
+            std::int64_t dod;
+            if (!bits.bit()) dod = 0;
+            else if (!bits.bit()) dod = impl::sign_extend(bits.read(7), 7);
+            else if (!bits.bit()) dod = impl::sign_extend(bits.read(9), 9);
+            else if (!bits.bit()) dod = impl::sign_extend(bits.read(12), 12);
+            else dod = std::int64_t(bits.read(64));
+            delta += dod;
+            tb += std::uint64_t(delta);
+
+            if (bits.bit()) {
+                if (bits.bit()) {
+                    lead = bits.read(5);
+                    unsigned len = bits.read(6)+1;
+                    trail = 64-lead-len;
+                }
+                vb ^= bits.read(64-lead-trail)<<trail;
+            }
+            emit();
+        }
+        p += nbytes;
+    }
+}
+
+// Read a whole gorilla trace file into separate time and value arrays.
+inline void read_gorilla_file(const std::string& path, std::vector<double>& t, std::vector<double>& v) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.good()) {
+        throw std::runtime_error("Unable to open trace file: "+path);
+    }
+    std::vector<unsigned char> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    t.clear();
+    v.clear();
+    gorilla_decode(buf.data(), buf.size(), [&](double ti, double vi) { t.push_back(ti); v.push_back(vi); });
+}
+
+// Test whether a file starts with the gorilla trace magic.
+inline bool is_gorilla_file(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    char magic[sizeof(gorilla_magic)] = {};
+    f.read(magic, sizeof(magic));
+    return f.good() && std::memcmp(magic, gorilla_magic, sizeof(magic))==0;
+}
+
+} // namespace sup
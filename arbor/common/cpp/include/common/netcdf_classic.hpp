@@ -0,0 +1,538 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sup {
+
+// Read-only view of a NetCDF classic format dataset (CDF-1, CDF-2 or CDF-5)
+// that is memory mapped in its entirety. Only the header is parsed on
+// construction: variable data is accessed in place, as big-endian slabs.
+//
+// NetCDF-4 (HDF5) datasets are not supported; xarray writes classic format
+// datasets with `to_netcdf(path, format='NETCDF3_64BIT')`.
+class netcdf_file {
+public:
+    enum nc_type: std::uint32_t {
+        nc_byte = 1, nc_char = 2, nc_short = 3, nc_int = 4, nc_float = 5, nc_double = 6,
+        nc_ubyte = 7, nc_ushort = 8, nc_uint = 9, nc_int64 = 10, nc_uint64 = 11
+    };
+
+    struct dimension {
+        std::string name;
+        std::uint64_t length;   // Zero for the record dimension.
+    };
+
+    struct variable {
+        std::string name;
+        std::vector<std::uint64_t> dimids;
+        nc_type type;
+        std::uint64_t begin;
+        bool is_record = false;
+        std::uint64_t slab_size = 1;  // Number of elements per record, or in total.
+    };
+
+    explicit netcdf_file(const std::string& path): path_(path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd<0) {
+            throw std::runtime_error("unable to open file");
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st)<0) {
+            ::close(fd);
+            throw std::runtime_error("unable to stat file");
+        }
+        size_ = st.st_size;
+
+        if (size_) {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p==MAP_FAILED) {
+                throw std::runtime_error("unable to map file");
+            }
+            data_ = static_cast<const unsigned char*>(p);
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+        }
+        else {
+            ::close(fd);
+        }
+
+        try {
+            parse_header();
+        }
+        catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    netcdf_file(const netcdf_file&) = delete;
+    netcdf_file& operator=(const netcdf_file&) = delete;
+
+    ~netcdf_file() { unmap(); }
+
+    const std::string& path() const { return path_; }
+    const std::vector<dimension>& dimensions() const { return dims_; }
+    const std::vector<variable>& variables() const { return vars_; }
+    std::uint64_t num_records() const { return numrecs_; }
+
+    const variable* find_variable(const std::string& name) const {
+        for (auto& v: vars_) {
+            if (v.name==name) return &v;
+        }
+        return nullptr;
+    }
+
+    // Whether a variable is a coordinate as xarray reads the file: a
+    // one-dimensional variable named after its dimension, or one named in
+    // a "coordinates" attribute. The others are xarray's data_vars.
+    bool is_coordinate(const variable& v) const {
+        return (v.dimids.size()==1 && dims_[v.dimids[0]].name==v.name) || coord_names_.count(v.name);
+    }
+
+    static std::size_t type_size(nc_type t) {
+        switch (t) {
+        case nc_byte: case nc_char: case nc_ubyte: return 1;
+        case nc_short: case nc_ushort: return 2;
+        case nc_int: case nc_uint: case nc_float: return 4;
+        case nc_double: case nc_int64: case nc_uint64: return 8;
+        }
+        return 0;
+    }
+
+    // Call f(const unsigned char* p, std::size_t n) for each contiguous slab of
+    // n big-endian elements of the variable: once for a fixed size variable,
+    // and once per record for a record variable.
+    template <typename F>
+    void for_each_slab(const variable& v, F&& f) const {
+        std::size_t bytes = v.slab_size*type_size(v.type);
+        std::uint64_t nslab = v.is_record? numrecs_: 1;
+        for (std::uint64_t r=0; r<nslab; ++r) {
+            std::uint64_t offset = v.begin + r*recsize_;
+            if (offset+bytes>size_) {
+                throw std::runtime_error("variable '"+v.name+"' extends past end of file");
+            }
+            if (v.slab_size) f(data_+offset, v.slab_size);
+        }
+    }
+
+private:
+    std::string path_;
+    const unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    int version_ = 0;
+    std::uint64_t numrecs_ = 0;
+    std::uint64_t recsize_ = 0;
+    std::vector<dimension> dims_;
+    std::vector<variable> vars_;
+    std::set<std::string> coord_names_;
+
+    void unmap() {
+        if (data_) ::munmap(const_cast<unsigned char*>(data_), size_);
+        data_ = nullptr;
+    }
+
+    // Header parsing: all values are big-endian; NON_NEG counts are 64-bit
+    // in CDF-5, and variable offsets are 64-bit in CDF-2 and CDF-5.
+
+    std::size_t pos_ = 0;
+
+    void need(std::size_t n) {
+        if (pos_+n>size_) throw std::runtime_error("truncated header");
+    }
+
+    std::uint64_t read_be(std::size_t n) {
+        need(n);
+        std::uint64_t x = 0;
+        for (std::size_t i=0; i<n; ++i) x = (x<<8) | data_[pos_++];
+        return x;
+    }
+
+    std::uint32_t read_u32() { return read_be(4); }
+    std::uint64_t read_non_neg() { return read_be(version_==5? 8: 4); }
+    std::uint64_t read_offset() { return read_be(version_==1? 4: 8); }
+
+    void skip_padded(std::uint64_t n) {
+        n = (n+3)/4*4;
+        need(n);
+        pos_ += n;
+    }
+
+    std::string read_name() {
+        auto n = read_non_neg();
+        need(n);
+        std::string s(reinterpret_cast<const char*>(data_+pos_), n);
+        skip_padded(n);
+        return s;
+    }
+
+    // Read past an attribute list, and add the names listed in its text
+    // "coordinates" attribute, if any, to coord_names_.
+    void read_attributes() {
+        auto tag = read_u32();
+        auto n = read_non_neg();
+        if (tag==0 && n==0) return;
+        if (tag!=0x0C) throw std::runtime_error("bad attribute list");
+
+        for (std::uint64_t i=0; i<n; ++i) {
+            auto name = read_name();
+            auto type = static_cast<nc_type>(read_u32());
+            auto nelems = read_non_neg();
+            if (name=="coordinates" && type==nc_char) {
+                need(nelems);
+                std::istringstream text(std::string(reinterpret_cast<const char*>(data_+pos_), nelems));
+                for (std::string c; text >> c; ) coord_names_.insert(c);
+            }
+            skip_padded(nelems*type_size(type));
+        }
+    }
+
+    void parse_header() {
+        if (size_<4 || std::memcmp(data_, "CDF", 3)) {
+            if (size_>=4 && std::memcmp(data_, "\x89HDF", 4)==0) {
+                throw std::runtime_error("NetCDF-4/HDF5 format is not supported");
+            }
+            throw std::runtime_error("not a NetCDF classic format file");
+        }
+        version_ = data_[3];
+        if (version_!=1 && version_!=2 && version_!=5) {
+            throw std::runtime_error("unsupported NetCDF format version "+std::to_string(version_));
+        }
+        pos_ = 4;
+
+        numrecs_ = read_non_neg();
+        bool streaming = numrecs_==(version_==5? ~std::uint64_t(0): 0xffffffffu);
+
+        auto tag = read_u32();
+        auto ndims = read_non_neg();
+        if (tag!=0x0A && !(tag==0 && ndims==0)) throw std::runtime_error("bad dimension list");
+        for (std::uint64_t i=0; i<ndims; ++i) {
+            dimension d;
+            d.name = read_name();
+            d.length = read_non_neg();
+            dims_.push_back(std::move(d));
+        }
+
+        read_attributes();
+
+        tag = read_u32();
+        auto nvars = read_non_neg();
+        if (tag!=0x0B && !(tag==0 && nvars==0)) throw std::runtime_error("bad variable list");
+
+        std::uint64_t record_bytes = 0;
+        unsigned num_record_vars = 0;
+        for (std::uint64_t i=0; i<nvars; ++i) {
+            variable v;
+            v.name = read_name();
+            auto rank = read_non_neg();
+            for (std::uint64_t j=0; j<rank; ++j) {
+                auto id = read_non_neg();
+                if (id>=dims_.size()) throw std::runtime_error("bad dimension id");
+                v.dimids.push_back(id);
+            }
+            read_attributes();
+            v.type = static_cast<nc_type>(read_u32());
+            if (!type_size(v.type)) throw std::runtime_error("bad type for variable '"+v.name+"'");
+            auto vsize = read_non_neg();
+            v.begin = read_offset();
+
+            for (std::size_t j=0; j<v.dimids.size(); ++j) {
+                auto len = dims_[v.dimids[j]].length;
+                if (len==0) {
+                    if (j!=0) throw std::runtime_error("record dimension not first in '"+v.name+"'");
+                    v.is_record = true;
+                }
+                else {
+                    v.slab_size *= len;
+                }
+            }
+            if (v.is_record) {
+                ++num_record_vars;
+                record_bytes += vsize;
+            }
+            vars_.push_back(std::move(v));
+        }
+
+        // A single record variable is not padded within the record.
+        if (num_record_vars==1) {
+            for (auto& v: vars_) {
+                if (v.is_record) record_bytes = v.slab_size*type_size(v.type);
+            }
+        }
+        recsize_ = record_bytes;
+
+        if (streaming) {
+            std::uint64_t first = size_;
+            for (auto& v: vars_) {
+                if (v.is_record && v.begin<first) first = v.begin;
+            }
+            numrecs_ = recsize_ && first<size_? (size_-first)/recsize_: 0;
+        }
+    }
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+inline std::uint8_t from_be(std::uint8_t x) { return x; }
+inline std::uint16_t from_be(std::uint16_t x) { return __builtin_bswap16(x); }
+inline std::uint32_t from_be(std::uint32_t x) { return __builtin_bswap32(x); }
+inline std::uint64_t from_be(std::uint64_t x) { return __builtin_bswap64(x); }
+#else
+template <typename U>
+inline U from_be(U x) { return x; }
+#endif
+
+// Decode one big-endian element of type T.
+template <typename T>
+inline T load_be(const unsigned char* p) {
+    static_assert(sizeof(T)==1 || sizeof(T)==2 || sizeof(T)==4 || sizeof(T)==8, "unsupported element size");
+    using U = typename std::conditional<sizeof(T)==1, std::uint8_t,
+              typename std::conditional<sizeof(T)==2, std::uint16_t,
+              typename std::conditional<sizeof(T)==4, std::uint32_t, std::uint64_t>::type>::type>::type;
+    U u;
+    std::memcpy(&u, p, sizeof(U));
+    u = from_be(u);
+    T x;
+    std::memcpy(&x, &u, sizeof(T));
+    return x;
+}
+
+// Decode n big-endian elements of the given type into doubles.
+inline void decode_be(netcdf_file::nc_type type, const unsigned char* p, std::size_t n, double* out) {
+    auto decode = [&](auto tag) {
+        using T = decltype(tag);
+        for (std::size_t i=0; i<n; ++i) out[i] = load_be<T>(p+i*sizeof(T));
+    };
+    switch (type) {
+    case netcdf_file::nc_byte:   decode(std::int8_t{}); break;
+    case netcdf_file::nc_char:   decode(char{}); break;
+    case netcdf_file::nc_ubyte:  decode(std::uint8_t{}); break;
+    case netcdf_file::nc_short:  decode(std::int16_t{}); break;
+    case netcdf_file::nc_ushort: decode(std::uint16_t{}); break;
+    case netcdf_file::nc_int:    decode(std::int32_t{}); break;
+    case netcdf_file::nc_uint:   decode(std::uint32_t{}); break;
+    case netcdf_file::nc_float:  decode(float{}); break;
+    case netcdf_file::nc_double: decode(double{}); break;
+    case netcdf_file::nc_int64:  decode(std::int64_t{}); break;
+    case netcdf_file::nc_uint64: decode(std::uint64_t{}); break;
+    }
+}
+
+// Encode one element of type T as big-endian.
+template <typename T>
+inline void store_be(T x, unsigned char* p) {
+    static_assert(sizeof(T)==1 || sizeof(T)==2 || sizeof(T)==4 || sizeof(T)==8, "unsupported element size");
+    using U = typename std::conditional<sizeof(T)==1, std::uint8_t,
+              typename std::conditional<sizeof(T)==2, std::uint16_t,
+              typename std::conditional<sizeof(T)==4, std::uint32_t, std::uint64_t>::type>::type>::type;
+    U u;
+    std::memcpy(&u, &x, sizeof(U));
+    u = from_be(u);
+    std::memcpy(p, &u, sizeof(U));
+}
+
+// Writer of a NetCDF classic format dataset (CDF-2) of fixed size float and
+// double variables, with text attributes.
+//
+// Dimensions, variables and attributes are declared first; write_header()
+// then lays out the variables, after which the data of each variable is
+// written in order, in one or more calls. A variable of more than 4 GiB is
+// allowed only as the last variable, as in the format specification.
+class netcdf_writer {
+public:
+    using nc_type = netcdf_file::nc_type;
+
+    explicit netcdf_writer(const std::string& path): path_(path) {
+        out_.open(path, std::ios::binary);
+        if (!out_.good()) {
+            throw std::runtime_error("Unable to open NetCDF output file: "+path);
+        }
+    }
+
+    netcdf_writer(const netcdf_writer&) = delete;
+    netcdf_writer& operator=(const netcdf_writer&) = delete;
+
+    unsigned add_dimension(const std::string& name, std::uint64_t length) {
+        if (!length) throw std::invalid_argument("netcdf: dimension '"+name+"' has zero length");
+        dims_.push_back({name, length});
+        return dims_.size()-1;
+    }
+
+    unsigned add_variable(const std::string& name, nc_type type, std::vector<unsigned> dimids) {
+        if (type!=netcdf_file::nc_float && type!=netcdf_file::nc_double) {
+            throw std::invalid_argument("netcdf: variable '"+name+"' must be float or double");
+        }
+        var v;
+        v.name = name;
+        v.type = type;
+        v.dimids = std::move(dimids);
+        for (auto d: v.dimids) v.size *= dims_.at(d).length;
+        vars_.push_back(std::move(v));
+        return vars_.size()-1;
+    }
+
+    void add_attribute(const std::string& name, const std::string& text) {
+        attrs_.push_back({name, text});
+    }
+
+    void add_attribute(unsigned var, const std::string& name, const std::string& text) {
+        vars_.at(var).attrs.push_back({name, text});
+    }
+
+    void write_header() {
+        std::vector<unsigned char> h = {'C', 'D', 'F', 2};
+        put_u32(h, 0);
+
+        put_u32(h, dims_.empty()? 0: 0x0A);
+        put_u32(h, dims_.size());
+        for (auto& d: dims_) {
+            put_name(h, d.name);
+            put_u32(h, d.length);
+        }
+        put_attributes(h, attrs_);
+
+        // The begin offsets are filled in once the header size is known.
+        std::vector<std::size_t> begin_at;
+        put_u32(h, vars_.empty()? 0: 0x0B);
+        put_u32(h, vars_.size());
+        for (std::size_t i=0; i<vars_.size(); ++i) {
+            auto& v = vars_[i];
+            put_name(h, v.name);
+            put_u32(h, v.dimids.size());
+            for (auto d: v.dimids) put_u32(h, d);
+            put_attributes(h, v.attrs);
+            put_u32(h, v.type);
+
+            std::uint64_t bytes = (v.size*netcdf_file::type_size(v.type)+3)/4*4;
+            if (bytes>0xffffffffu && i+1!=vars_.size()) {
+                throw std::runtime_error("netcdf: variable '"+v.name+"' exceeds 4 GiB and is not the last variable");
+            }
+            put_u32(h, bytes>0xffffffffu? 0xffffffffu: bytes);
+            begin_at.push_back(h.size());
+            h.resize(h.size()+8);
+        }
+
+        std::uint64_t offset = h.size();
+        for (std::size_t i=0; i<vars_.size(); ++i) {
+            auto& v = vars_[i];
+            v.begin = offset;
+            store_be(offset, &h[begin_at[i]]);
+            offset += (v.size*netcdf_file::type_size(v.type)+3)/4*4;
+        }
+        end_ = offset;
+
+        out_.write(reinterpret_cast<const char*>(h.data()), h.size());
+        header_written_ = true;
+    }
+
+    // Write the next n elements of the variable, converting to its type.
+    template <typename T>
+    void write(unsigned var, const T* data, std::size_t n) {
+        auto& v = vars_.at(var);
+        if (!header_written_) throw std::logic_error("netcdf: data written before header");
+        if (v.written+n>v.size) {
+            throw std::runtime_error("netcdf: too much data for variable '"+v.name+"'");
+        }
+
+        const std::size_t tsize = netcdf_file::type_size(v.type);
+        buf_.resize(n*tsize);
+        if (v.type==netcdf_file::nc_float) {
+            for (std::size_t i=0; i<n; ++i) store_be(float(data[i]), &buf_[i*tsize]);
+        }
+        else {
+            for (std::size_t i=0; i<n; ++i) store_be(double(data[i]), &buf_[i*tsize]);
+        }
+
+        out_.seekp(v.begin+v.written*tsize);
+        out_.write(reinterpret_cast<const char*>(buf_.data()), buf_.size());
+        v.written += n;
+    }
+
+    // Check that every variable is complete, pad, and close the file.
+    void close() {
+        for (auto& v: vars_) {
+            if (v.written!=v.size) {
+                throw std::runtime_error("netcdf: variable '"+v.name+"' is incomplete");
+            }
+        }
+        static const char zeros[4] = {};
+        out_.seekp(0, std::ios::end);
+        std::uint64_t size = out_.tellp();
+        if (size<end_) out_.write(zeros, end_-size);
+        out_.close();
+        if (out_.fail()) {
+            throw std::runtime_error("Unable to write NetCDF output file: "+path_);
+        }
+    }
+
+private:
+    struct attribute {
+        std::string name;
+        std::string text;
+    };
+
+    struct dim {
+        std::string name;
+        std::uint64_t length;
+    };
+
+    struct var {
+        std::string name;
+        nc_type type;
+        std::vector<unsigned> dimids;
+        std::vector<attribute> attrs;
+        std::uint64_t size = 1;
+        std::uint64_t begin = 0;
+        std::uint64_t written = 0;
+    };
+
+    std::string path_;
+    std::ofstream out_;
+    std::vector<dim> dims_;
+    std::vector<var> vars_;
+    std::vector<attribute> attrs_;
+    std::uint64_t end_ = 0;
+    bool header_written_ = false;
+    std::vector<unsigned char> buf_;
+
+    static void put_u32(std::vector<unsigned char>& h, std::uint64_t x) {
+        if (x>0xffffffffu) throw std::runtime_error("netcdf: header value out of range");
+        h.resize(h.size()+4);
+        store_be(std::uint32_t(x), &h[h.size()-4]);
+    }
+
+    static void put_padded(std::vector<unsigned char>& h, const std::string& s) {
+        h.insert(h.end(), s.begin(), s.end());
+        h.resize(h.size()+(4-s.size()%4)%4, 0);
+    }
+
+    static void put_name(std::vector<unsigned char>& h, const std::string& s) {
+        put_u32(h, s.size());
+        put_padded(h, s);
+    }
+
+    static void put_attributes(std::vector<unsigned char>& h, const std::vector<attribute>& attrs) {
+        put_u32(h, attrs.empty()? 0: 0x0C);
+        put_u32(h, attrs.size());
+        for (auto& a: attrs) {
+            put_name(h, a.name);
+            put_u32(h, netcdf_file::nc_char);
+            put_name(h, a.text);
+        }
+    }
+};
+
+} // namespace sup
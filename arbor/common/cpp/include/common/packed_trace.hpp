@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace sup {
+
+// Reduced precision traces: one or more value columns sampled at shared
+// times, with values stored as float32, or as int16 with a per-column scale
+// and offset fitted to the range of the run.
+//
+// Layout, all little-endian:
+//
+//     magic      "PKDTRC02"
+//     uint64     length of the metadata
+//     metadata   json, zero padded to a multiple of 8 bytes
+//     ticks      uint32[n], padded to 8 bytes
+//     columns    per column float32[n] or int16[n], padded to 8 bytes
+//
+// The metadata records the value type, sample count, time quantum, and the
+// maximum absolute error of the stored times and of each column's values
+// with respect to the double precision samples.
+//
+// Ticks are offsets from the base tick of the block of samples they fall
+// in, listed in the metadata as "blocks": [[first sample, base tick], ...],
+// and time t = (base+tick)*time_quantum. A new block starts whenever the
+// offset would not fit in 32 bits, so runs of any length can be stored.
+// Files of the first version, "PKDTRC01", have one block with base 0.
+
+constexpr char packed_magic[8] = {'P', 'K', 'D', 'T', 'R', 'C', '0', '2'};
+constexpr char packed_magic_v1[8] = {'P', 'K', 'D', 'T', 'R', 'C', '0', '1'};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__!=__ORDER_LITTLE_ENDIAN__
+#error "packed traces require a little-endian host"
+#endif
+
+enum class packed_type { float32, int16 };
+
+// Accumulates samples as uint32 time tick offsets and float32 values, half
+// the memory of double precision (time, value) pairs for one column.
+class packed_trace {
+public:
+    struct column {
+        std::string name;
+        std::string units;
+    };
+
+    packed_trace(double time_quantum, std::vector<column> columns):
+        quantum_(time_quantum), columns_(std::move(columns)),
+        values_(columns_.size()), float_error_(columns_.size(), 0.)
+    {
+        if (!(quantum_>0)) {
+            throw std::invalid_argument("packed trace: time quantum must be positive");
+        }
+    }
+
+    // Append one sample time, with a value for each column.
+    void append(double t, const double* v) {
+        double tick = std::round(t/quantum_);
+        if (!(tick>=0 && tick<=9007199254740992.)) {
+            throw std::range_error("packed trace: time out of range of the time quantum");
+        }
+        const std::uint64_t k = tick;
+        if (blocks_.empty() || k<blocks_.back().second || k-blocks_.back().second>std::numeric_limits<std::uint32_t>::max()) {
+            blocks_.push_back({ticks_.size(), k});
+        }
+        ticks_.push_back(std::uint32_t(k-blocks_.back().second));
+        time_error_ = std::max(time_error_, std::abs(t-tick*quantum_));
+
+        for (std::size_t c=0; c<values_.size(); ++c) {
+            float f = v[c];
+            values_[c].push_back(f);
+            float_error_[c] = std::max(float_error_[c], std::abs(v[c]-double(f)));
+        }
+    }
+
+    std::size_t size() const { return ticks_.size(); }
+
+    void write(const std::string& path, packed_type type) const {
+        const std::size_t n = ticks_.size();
+
+        nlohmann::json meta;
+        meta["value_type"] = type==packed_type::float32? "float32": "int16";
+        meta["num_samples"] = n;
+        meta["time_quantum"] = quantum_;
+        meta["max_time_error"] = time_error_;
+        auto& jblocks = meta["blocks"] = nlohmann::json::array();
+        for (auto& b: blocks_) jblocks.push_back({b.first, b.second});
+
+        std::vector<std::vector<std::int16_t>> quantized(values_.size());
+        auto& jcols = meta["columns"] = nlohmann::json::array();
+        for (std::size_t c=0; c<values_.size(); ++c) {
+            const auto& vals = values_[c];
+            nlohmann::json jc;
+            jc["name"] = columns_[c].name;
+            jc["units"] = columns_[c].units;
+
+            if (type==packed_type::float32) {
+                jc["max_abs_error"] = float_error_[c];
+            }
+            else {
+                // Map [min, max] onto [-32767, 32767].
+                double lo = 0, hi = 0;
+                if (n) {
+                    auto mm = std::minmax_element(vals.begin(), vals.end());
+                    lo = *mm.first;
+                    hi = *mm.second;
+                }
+                double offset = 0.5*(lo+hi);
+                double scale = hi>lo? (hi-lo)/65534: 1;
+
+                double err = 0;
+                auto& q = quantized[c];
+                q.reserve(n);
+                for (auto f: vals) {
+                    double k = std::min(std::max(std::round((f-offset)/scale), -32767.), 32767.);
+                    q.push_back(std::int16_t(k));
+                    err = std::max(err, std::abs(f-(offset+scale*k)));
+                }
+                jc["scale"] = scale;
+                jc["offset"] = offset;
+                // Bound on the error relative to the double precision values.
+                jc["max_abs_error"] = err+float_error_[c];
+            }
+            jcols.push_back(jc);
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        if (!out.good()) {
+            throw std::runtime_error("Unable to open trace output file: "+path);
+        }
+
+        auto pad = [&out](std::size_t nbytes) {
+            static const char zeros[8] = {};
+            out.write(zeros, (8-nbytes%8)%8);
+        };
+
+        std::string text = meta.dump();
+        std::uint64_t len = text.size();
+        out.write(packed_magic, sizeof(packed_magic));
+        out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.write(text.data(), text.size());
+        pad(text.size());
+
+        out.write(reinterpret_cast<const char*>(ticks_.data()), n*sizeof(std::uint32_t));
+        pad(n*sizeof(std::uint32_t));
+
+        for (std::size_t c=0; c<values_.size(); ++c) {
+            if (type==packed_type::float32) {
+                out.write(reinterpret_cast<const char*>(values_[c].data()), n*sizeof(float));
+                pad(n*sizeof(float));
+            }
+            else {
+                out.write(reinterpret_cast<const char*>(quantized[c].data()), n*sizeof(std::int16_t));
+                pad(n*sizeof(std::int16_t));
+            }
+        }
+        if (!out.good()) {
+            throw std::runtime_error("Unable to write trace output file: "+path);
+        }
+    }
+
+private:
+    double quantum_;
+    std::vector<column> columns_;
+
+    std::vector<std::uint32_t> ticks_;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> blocks_;   // (first sample, base tick)
+    std::vector<std::vector<float>> values_;
+    double time_error_ = 0;
+    std::vector<double> float_error_;
+};
+
+// Read a packed trace into times and value columns of doubles. Returns the
+// metadata.
+inline nlohmann::json read_packed_trace(const std::string& path,
+    std::vector<double>& times, std::vector<std::vector<double>>& columns)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f.good()) {
+        throw std::runtime_error("Unable to open trace file: "+path);
+    }
+    std::vector<char> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    auto padded = [](std::size_t nbytes) { return (nbytes+7)/8*8; };
+    const char* p = buf.data();
+    const char* end = p+buf.size();
+    auto take = [&](std::size_t nbytes) {
+        if (std::size_t(end-p)<nbytes) throw std::runtime_error("packed trace: truncated file: "+path);
+        const char* q = p;
+        p += padded(nbytes);
+        if (p>end) p = end;
+        return q;
+    };
+
+    if (buf.size()<16 || (std::memcmp(p, packed_magic, sizeof(packed_magic))
+                          && std::memcmp(p, packed_magic_v1, sizeof(packed_magic_v1)))) {
+        throw std::runtime_error("packed trace: bad magic: "+path);
+    }
+    take(sizeof(packed_magic));
+    std::uint64_t len;
+    std::memcpy(&len, take(sizeof(len)), sizeof(len));
+    auto meta = nlohmann::json::parse(std::string(take(len), len));
+
+    const std::size_t n = meta.at("num_samples");
+    const double quantum = meta.at("time_quantum");
+    const bool is_float = meta.at("value_type")=="float32";
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> blocks = {{0, 0}};
+    if (meta.count("blocks")) {
+        blocks.clear();
+        for (auto& jb: meta.at("blocks")) {
+            blocks.push_back({jb.at(0).get<std::uint64_t>(), jb.at(1).get<std::uint64_t>()});
+        }
+        if (blocks.empty()) blocks.push_back({0, 0});
+    }
+
+    const char* t = take(n*sizeof(std::uint32_t));
+    times.resize(n);
+    std::size_t b = 0;
+    for (std::size_t i=0; i<n; ++i) {
+        while (b+1<blocks.size() && blocks[b+1].first<=i) ++b;
+        std::uint32_t tick;
+        std::memcpy(&tick, t+i*sizeof(tick), sizeof(tick));
+        times[i] = (blocks[b].second+tick)*quantum;
+    }
+
+    const auto& jcols = meta.at("columns");
+    columns.assign(jcols.size(), std::vector<double>(n));
+    for (std::size_t c=0; c<jcols.size(); ++c) {
+        auto& col = columns[c];
+        if (is_float) {
+            const char* v = take(n*sizeof(float));
+            for (std::size_t i=0; i<n; ++i) {
+                float x;
+                std::memcpy(&x, v+i*sizeof(x), sizeof(x));
+                col[i] = x;
+            }
+        }
+        else {
+            const double scale = jcols[c].at("scale");
+            const double offset = jcols[c].at("offset");
+            const char* v = take(n*sizeof(std::int16_t));
+            for (std::size_t i=0; i<n; ++i) {
+                std::int16_t k;
+                std::memcpy(&k, v+i*sizeof(k), sizeof(k));
+                col[i] = offset+scale*k;
+            }
+        }
+    }
+    return meta;
+}
+
+// Test whether a file starts with the packed trace magic.
+inline bool is_packed_trace(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    char magic[sizeof(packed_magic)] = {};
+    f.read(magic, sizeof(magic));
+    return f.good() && (std::memcmp(magic, packed_magic, sizeof(magic))==0
+                        || std::memcmp(magic, packed_magic_v1, sizeof(magic))==0);
+}
+
+} // namespace sup
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sup {
+
+// Input spike trains of many synaptic targets in one binary file, read in
+// place through a read-only memory map, so that opening a file costs the
+// same whatever the length of the trains, and only the pages of times that
+// are read are ever loaded.
+//
+// Layout, all little-endian:
+//
+//     magic      "SPKTRN01"
+//     uint64     number of trains n
+//     index      n entries {uint32 gid, uint32 target, uint64 first, uint64 last},
+//                sorted by (gid, target)
+//     times      float64, the times of each train at [first, last), ascending
+//
+// common/bin/pack-spikes writes such files from spike lists.
+
+constexpr char spike_train_magic[8] = {'S', 'P', 'K', 'T', 'R', 'N', '0', '1'};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__!=__ORDER_LITTLE_ENDIAN__
+#error "spike train files require a little-endian host"
+#endif
+
+struct spike_train_entry {
+    std::uint32_t gid;
+    std::uint32_t target;
+    std::uint64_t first;
+    std::uint64_t last;
+};
+static_assert(sizeof(spike_train_entry)==24, "spike train index entries must be packed");
+
+class mapped_spike_trains {
+public:
+    // The times of one train.
+    struct train {
+        std::uint32_t target;
+        const double* begin;
+        const double* end;
+    };
+
+    explicit mapped_spike_trains(const std::string& path): path_(path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd<0) {
+            throw std::runtime_error("Unable to open spike train file: "+path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) || st.st_size<16) {
+            ::close(fd);
+            throw std::runtime_error("spike trains: truncated file: "+path);
+        }
+        size_ = st.st_size;
+        data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data_==MAP_FAILED) {
+            throw std::runtime_error("spike trains: unable to map file: "+path);
+        }
+
+        try {
+            const char* p = static_cast<const char*>(data_);
+            if (std::memcmp(p, spike_train_magic, sizeof(spike_train_magic))) {
+                throw std::runtime_error("spike trains: bad magic: "+path);
+            }
+            std::uint64_t n;
+            std::memcpy(&n, p+8, sizeof(n));
+            if (n>(size_-16)/sizeof(spike_train_entry)) {
+                throw std::runtime_error("spike trains: truncated index: "+path);
+            }
+            index_ = reinterpret_cast<const spike_train_entry*>(p+16);
+            num_trains_ = n;
+            times_ = reinterpret_cast<const double*>(p+16+n*sizeof(spike_train_entry));
+            num_times_ = (size_-16-n*sizeof(spike_train_entry))/sizeof(double);
+
+            for (std::size_t i=0; i<n; ++i) {
+                const auto& e = index_[i];
+                if (e.first>e.last || e.last>num_times_) {
+                    throw std::runtime_error("spike trains: index entry out of range: "+path);
+                }
+                if (i && !(std::make_pair(index_[i-1].gid, index_[i-1].target)<std::make_pair(e.gid, e.target))) {
+                    throw std::runtime_error("spike trains: index not sorted by (gid, target): "+path);
+                }
+            }
+        }
+        catch (...) {
+            ::munmap(data_, size_);
+            throw;
+        }
+    }
+
+    mapped_spike_trains(const mapped_spike_trains&) = delete;
+    mapped_spike_trains& operator=(const mapped_spike_trains&) = delete;
+
+    ~mapped_spike_trains() {
+        ::munmap(data_, size_);
+    }
+
+    // The trains of the targets of a cell, by binary search of the index.
+    std::vector<train> trains_of(std::uint32_t gid) const {
+        auto lo = std::lower_bound(index_, index_+num_trains_, gid,
+            [](const spike_train_entry& e, std::uint32_t g) { return e.gid<g; });
+        std::vector<train> trains;
+        for (auto e = lo; e!=index_+num_trains_ && e->gid==gid; ++e) {
+            trains.push_back({e->target, times_+e->first, times_+e->last});
+        }
+        return trains;
+    }
+
+    std::size_t num_trains() const { return num_trains_; }
+    std::size_t num_spikes() const { return num_times_; }
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    const spike_train_entry* index_ = nullptr;
+    std::size_t num_trains_ = 0;
+    const double* times_ = nullptr;
+    std::size_t num_times_ = 0;
+};
+
+} // namespace sup
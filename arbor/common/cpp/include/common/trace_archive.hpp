@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sup {
+
+// Single-file archive of many runs, each with one sampled trace and a spike
+// list, that readers memory map for zero-copy random access.
+//
+// Layout, all little-endian and 8-byte aligned:
+//
+//     header     "ARBARC03", uint64 committed size
+//     per append:
+//       run      float64 times[n], float64 values[n], archive_spike spikes[m]
+//       index    archive_index_entry of the run
+//       footer   uint64 index offset, uint64 entries, uint64 end of the
+//                previous footer, uint64 total runs, "ARBIDX02"
+//
+// The archive is the first committed size bytes of the file, ending with
+// the footer of the latest append. Each footer points back to the end of
+// the one before (the header size for the first), so that the index is the
+// chain of index entries from the first append to the latest, and every
+// append costs only the size of its run. Appending never writes below the
+// committed size: the run data, its index entry and a new footer go after
+// the old footer, and only once they are synced is the committed size in
+// the header updated. An append that fails partway leaves the archive as it
+// was, and readers can map the committed part of the file while runs are
+// appended.
+//
+// Writers take an exclusive lock on the file, so that concurrent runs of a
+// sweep can append to the same archive; readers take a shared lock while
+// they read the header and index.
+
+constexpr char archive_magic[8] = {'A', 'R', 'B', 'A', 'R', 'C', '0', '3'};
+constexpr char archive_index_magic[8] = {'A', 'R', 'B', 'I', 'D', 'X', '0', '2'};
+
+struct archive_spike {
+    std::uint64_t gid;
+    double time;
+};
+
+struct archive_index_entry {
+    std::uint64_t run_id;
+    std::uint64_t param_hash;
+    std::uint64_t num_samples;
+    std::uint64_t times_offset;
+    std::uint64_t values_offset;
+    std::uint64_t num_spikes;
+    std::uint64_t spikes_offset;
+};
+
+struct archive_header {
+    char magic[8];
+    std::uint64_t committed_size;
+};
+
+struct archive_footer {
+    std::uint64_t index_offset;
+    std::uint64_t num_entries;
+    std::uint64_t previous_end;
+    std::uint64_t num_runs;
+    char magic[8];
+};
+
+static_assert(sizeof(archive_spike)==16, "unexpected archive_spike layout");
+static_assert(sizeof(archive_index_entry)==56, "unexpected archive_index_entry layout");
+static_assert(sizeof(archive_footer)==40, "unexpected archive_footer layout");
+static_assert(sizeof(archive_header)==16, "unexpected archive_header layout");
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__!=__ORDER_LITTLE_ENDIAN__
+#error "trace archives are read in place and require a little-endian host"
+#endif
+
+// 64-bit FNV-1a hash, used for hashing parameter sets.
+inline std::uint64_t fnv1a_hash(const std::string& s) {
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c: s) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+namespace impl {
+
+inline void pwrite_all(int fd, const void* data, std::size_t n, std::uint64_t offset) {
+    auto p = static_cast<const char*>(data);
+    while (n) {
+        auto k = ::pwrite(fd, p, n, offset);
+        if (k<0) throw std::runtime_error("archive: write failed");
+        p += k;
+        n -= k;
+        offset += k;
+    }
+}
+
+inline void pread_all(int fd, void* data, std::size_t n, std::uint64_t offset) {
+    auto p = static_cast<char*>(data);
+    while (n) {
+        auto k = ::pread(fd, p, n, offset);
+        if (k<=0) throw std::runtime_error("archive: read failed");
+        p += k;
+        n -= k;
+        offset += k;
+    }
+}
+
+inline void sync(int fd) {
+    if (::fsync(fd)<0) throw std::runtime_error("archive: sync failed");
+}
+
+// Read and check the header of an archive of the given file size; returns
+// the committed size.
+inline std::uint64_t read_header(int fd, std::uint64_t file_size, const std::string& path) {
+    archive_header h;
+    if (file_size<sizeof(h)) {
+        throw std::runtime_error("archive: not a trace archive: "+path);
+    }
+    pread_all(fd, &h, sizeof(h), 0);
+    if (std::memcmp(h.magic, archive_magic, sizeof(archive_magic))) {
+        throw std::runtime_error("archive: not a trace archive: "+path);
+    }
+    if (h.committed_size<sizeof(h) || h.committed_size>file_size) {
+        throw std::runtime_error("archive: bad header: "+path);
+    }
+    return h.committed_size;
+}
+
+// Check the footer that ends at offset end of an archive of the given data.
+inline const archive_footer& footer_at(const char* data, std::uint64_t end) {
+    if (end<sizeof(archive_header)+sizeof(archive_footer)) {
+        throw std::runtime_error("archive: bad footer");
+    }
+    const auto& f = *reinterpret_cast<const archive_footer*>(data+end-sizeof(archive_footer));
+    if (std::memcmp(f.magic, archive_index_magic, sizeof(archive_index_magic))
+        || f.index_offset+f.num_entries*sizeof(archive_index_entry)+sizeof(archive_footer)!=end
+        || f.previous_end<sizeof(archive_header) || f.previous_end>f.index_offset)
+    {
+        throw std::runtime_error("archive: bad footer");
+    }
+    return f;
+}
+
+// The number of runs in an archive of the given committed size, from the
+// latest footer.
+inline std::uint64_t read_num_runs(int fd, std::uint64_t size) {
+    if (size==sizeof(archive_header)) return 0;
+    archive_footer footer;
+    if (size<sizeof(archive_header)+sizeof(footer)) {
+        throw std::runtime_error("archive: file too short");
+    }
+    pread_all(fd, &footer, sizeof(footer), size-sizeof(footer));
+    if (std::memcmp(footer.magic, archive_index_magic, sizeof(archive_index_magic))) {
+        throw std::runtime_error("archive: bad footer");
+    }
+    return footer.num_runs;
+}
+
+// The index of the archive held in data of the given committed size, in
+// order of appending, from the chain of footers.
+inline std::vector<archive_index_entry> read_index(const char* data, std::uint64_t size) {
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> chunks;   // (offset, entries)
+    std::uint64_t num_runs = 0;
+    for (std::uint64_t end = size; end>sizeof(archive_header); ) {
+        const auto& f = footer_at(data, end);
+        if (end==size) num_runs = f.num_runs;
+        chunks.push_back({f.index_offset, f.num_entries});
+        end = f.previous_end;
+    }
+
+    std::vector<archive_index_entry> index;
+    index.reserve(num_runs);
+    for (auto c = chunks.rbegin(); c!=chunks.rend(); ++c) {
+        auto e = reinterpret_cast<const archive_index_entry*>(data+c->first);
+        index.insert(index.end(), e, e+c->second);
+    }
+    if (index.size()!=num_runs) {
+        throw std::runtime_error("archive: bad index");
+    }
+    return index;
+}
+
+} // namespace impl
+
+// Append a run to the archive at path, creating it if necessary.
+// Returns the run id, which is the number of runs previously in the archive
+// if run_id is negative.
+inline std::uint64_t archive_append(
+    const std::string& path,
+    std::int64_t run_id,
+    std::uint64_t param_hash,
+    const std::vector<double>& times,
+    const std::vector<double>& values,
+    const std::vector<archive_spike>& spikes)
+{
+    if (times.size()!=values.size()) {
+        throw std::invalid_argument("archive: time and value counts differ");
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR|O_CREAT, 0666);
+    if (fd<0) {
+        throw std::runtime_error("archive: unable to open "+path);
+    }
+
+    try {
+        if (::flock(fd, LOCK_EX)<0) {
+            throw std::runtime_error("archive: unable to lock "+path);
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st)<0) {
+            throw std::runtime_error("archive: unable to stat "+path);
+        }
+
+        archive_header header;
+        std::memcpy(header.magic, archive_magic, sizeof(header.magic));
+        header.committed_size = sizeof(header);
+        if (st.st_size==0) {
+            impl::pwrite_all(fd, &header, sizeof(header), 0);
+            impl::sync(fd);
+        }
+        else {
+            header.committed_size = impl::read_header(fd, st.st_size, path);
+        }
+
+        // Anything past the committed size is left from a failed append.
+        const std::uint64_t num_runs = impl::read_num_runs(fd, header.committed_size);
+        std::uint64_t offset = header.committed_size;
+
+        archive_index_entry e;
+        e.run_id = run_id<0? num_runs: run_id;
+        e.param_hash = param_hash;
+        e.num_samples = times.size();
+        e.num_spikes = spikes.size();
+
+        const std::size_t nbytes = times.size()*sizeof(double);
+        e.times_offset = offset;
+        impl::pwrite_all(fd, times.data(), nbytes, offset);
+        offset += nbytes;
+
+        e.values_offset = offset;
+        impl::pwrite_all(fd, values.data(), nbytes, offset);
+        offset += nbytes;
+
+        e.spikes_offset = offset;
+        impl::pwrite_all(fd, spikes.data(), spikes.size()*sizeof(archive_spike), offset);
+        offset += spikes.size()*sizeof(archive_spike);
+
+        archive_footer footer;
+        footer.index_offset = offset;
+        footer.num_entries = 1;
+        footer.previous_end = header.committed_size;
+        footer.num_runs = num_runs+1;
+        std::memcpy(footer.magic, archive_index_magic, sizeof(footer.magic));
+
+        impl::pwrite_all(fd, &e, sizeof(e), offset);
+        offset += sizeof(e);
+        impl::pwrite_all(fd, &footer, sizeof(footer), offset);
+        offset += sizeof(footer);
+        impl::sync(fd);
+
+        // Commit the append.
+        header.committed_size = offset;
+        impl::pwrite_all(fd, &header.committed_size, sizeof(header.committed_size), sizeof(archive_magic));
+        impl::sync(fd);
+
+        if (std::uint64_t(st.st_size)>offset && ::ftruncate(fd, offset)<0) {
+            throw std::runtime_error("archive: unable to truncate "+path);
+        }
+        ::close(fd);
+        return e.run_id;
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+// Zero-copy view of one archived run.
+struct archive_run {
+    std::uint64_t run_id;
+    std::uint64_t param_hash;
+
+    const double* times;
+    const double* values;
+    std::size_t num_samples;
+
+    const archive_spike* spikes;
+    std::size_t num_spikes;
+
+    // Restrict the samples to those with time in [t0, t1), by binary search.
+    archive_run window(double t0, double t1) const {
+        archive_run w = *this;
+        auto b = std::lower_bound(times, times+num_samples, t0);
+        auto e = std::lower_bound(b, times+num_samples, t1);
+        w.times = b;
+        w.values = values+(b-times);
+        w.num_samples = e-b;
+
+        auto sb = std::lower_bound(spikes, spikes+num_spikes, t0,
+            [](const archive_spike& s, double t) { return s.time<t; });
+        auto se = std::lower_bound(sb, spikes+num_spikes, t1,
+            [](const archive_spike& s, double t) { return s.time<t; });
+        w.spikes = sb;
+        w.num_spikes = se-sb;
+        return w;
+    }
+};
+
+// Read-only memory mapped trace archive. The index is copied when the
+// archive is opened, following the chain of footers, and runs appended
+// later are not seen.
+class trace_archive {
+public:
+    explicit trace_archive(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd<0) {
+            throw std::runtime_error("archive: unable to open "+path);
+        }
+
+        try {
+            if (::flock(fd, LOCK_SH)<0) {
+                throw std::runtime_error("archive: unable to lock "+path);
+            }
+            struct stat st;
+            if (::fstat(fd, &st)<0) {
+                throw std::runtime_error("archive: unable to stat "+path);
+            }
+            size_ = impl::read_header(fd, st.st_size, path);
+
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p==MAP_FAILED) {
+                throw std::runtime_error("archive: unable to map "+path);
+            }
+            data_ = static_cast<const char*>(p);
+            index_ = impl::read_index(data_, size_);
+
+            // The lock would last as long as the mapping, which outlives the
+            // descriptor, so release it explicitly. Appends rewrite nothing
+            // mapped but the committed size in the header, which is not read
+            // again, so no lock is needed once the index is copied.
+            ::flock(fd, LOCK_UN);
+            ::close(fd);
+        }
+        catch (...) {
+            if (data_) ::munmap(const_cast<char*>(data_), size_);
+            data_ = nullptr;
+            ::close(fd);
+            throw;
+        }
+
+        for (std::size_t i=0; i<index_.size(); ++i) {
+            by_id_[index_[i].run_id] = i;
+        }
+    }
+
+    trace_archive(const trace_archive&) = delete;
+    trace_archive& operator=(const trace_archive&) = delete;
+
+    ~trace_archive() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    std::size_t num_runs() const { return index_.size(); }
+
+    // Run by position in the archive.
+    archive_run run(std::size_t i) const {
+        if (i>=index_.size()) throw std::out_of_range("archive: run index out of range");
+        const auto& e = index_[i];
+        return archive_run{
+            e.run_id, e.param_hash,
+            reinterpret_cast<const double*>(data_+e.times_offset),
+            reinterpret_cast<const double*>(data_+e.values_offset),
+            e.num_samples,
+            reinterpret_cast<const archive_spike*>(data_+e.spikes_offset),
+            e.num_spikes
+        };
+    }
+
+    // Run by run id; if an id was appended more than once, the latest.
+    archive_run find(std::uint64_t run_id) const {
+        auto it = by_id_.find(run_id);
+        if (it==by_id_.end()) throw std::out_of_range("archive: no run with id "+std::to_string(run_id));
+        return run(it->second);
+    }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::vector<archive_index_entry> index_;
+    std::unordered_map<std::uint64_t, std::size_t> by_id_;
+};
+
+// Test whether a file starts with the trace archive magic.
+inline bool is_trace_archive(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd<0) return false;
+    char magic[sizeof(archive_magic)];
+    bool ok = ::read(fd, magic, sizeof(magic))==sizeof(magic) && !std::memcmp(magic, archive_magic, sizeof(magic));
+    ::close(fd);
+    return ok;
+}
+
+} // namespace sup
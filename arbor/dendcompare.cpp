@@ -0,0 +1,335 @@
+/*
+ * Compare the voltage along the dendrite recorded by single --dendrite with
+ * a NEURON reference from test_single.py --dendrite, as an error map over
+ * time and position written to a NetCDF dataset.
+ *
+ * Both recordings are memory mapped dendrite matrices. The reference is
+ * interpolated linearly in time and along the cable onto the sample times
+ * and positions of the input; the interpolation indices and weights are
+ * computed once, so that the per-row work is a pair of flat loops over
+ * floats that the compiler vectorizes. Rows are split among threads.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common/dendrite_matrix.hpp>
+#include <common/netcdf_classic.hpp>
+
+const char* usage_str =
+    "usage: dendcompare [-h] -r REF [-o OUT] [-j N] [-b BIN] INPUT\n"
+    "\n"
+    "Compare the dendrite matrix INPUT against the reference dendrite matrix\n"
+    "REF, interpolated onto the sample times and positions of INPUT, and\n"
+    "write the error map to the NetCDF dataset OUT (default error.nc):\n"
+    "\n"
+    "  error(time, position)    INPUT - REF, or with -b the maximum absolute\n"
+    "                           error over time bins of BIN ms\n"
+    "  max_error_time(time)     maximum absolute error over positions\n"
+    "  max_error(position)      maximum absolute error over time\n"
+    "  rms_error(position)      root mean square error over time\n"
+    "\n"
+    "Samples of INPUT outside the time range of REF are left out. The error\n"
+    "is computed on N threads (default: all hardware threads).\n";
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+double seconds_since(clock_type::time_point t) {
+    return std::chrono::duration<double>(clock_type::now()-t).count();
+}
+
+// Linear interpolation of a reference row onto the input positions: value
+// at input position j is r[index[j]]*(1-weight[j]) + r[index[j]+1]*weight[j].
+struct position_map {
+    bool identity = false;
+    std::vector<std::uint32_t> index;
+    std::vector<float> weight;
+};
+
+position_map map_positions(const std::vector<double>& x, const std::vector<double>& ref) {
+    position_map m;
+    if (x==ref) {
+        m.identity = true;
+        return m;
+    }
+    if (ref.size()<2) {
+        throw std::runtime_error("reference has fewer than two positions");
+    }
+
+    // Positions beyond the ends of the reference take its end values.
+    std::size_t k = 0;
+    for (double p: x) {
+        while (k+2<ref.size() && ref[k+1]<p) ++k;
+        double w = (p-ref[k])/(ref[k+1]-ref[k]);
+        m.index.push_back(k);
+        m.weight.push_back(std::min(std::max(w, 0.), 1.));
+    }
+    return m;
+}
+
+// Per-position error statistics of one thread.
+struct position_stats {
+    std::vector<float> max_abs;
+    std::vector<double> sum_sq;
+    std::size_t count = 0;
+
+    explicit position_stats(std::size_t n): max_abs(n, 0.f), sum_sq(n, 0.) {}
+
+    void merge(const position_stats& o) {
+        for (std::size_t j=0; j<max_abs.size(); ++j) {
+            max_abs[j] = std::max(max_abs[j], o.max_abs[j]);
+            sum_sq[j] += o.sum_sq[j];
+        }
+        count += o.count;
+    }
+};
+
+class comparison {
+public:
+    comparison(const sup::mapped_dendrite_matrix& in, const sup::mapped_dendrite_matrix& ref):
+        in_(in), ref_(ref), map_(map_positions(in.positions(), ref.positions())),
+        np_(in.num_positions())
+    {
+        // Reference row and weight for each input time, by a merge of the
+        // two ascending time sequences.
+        const std::size_t nref = ref.num_times();
+        if (!nref) throw std::runtime_error("reference has no samples");
+        const double t0 = ref.time(0), t1 = ref.time(nref-1);
+
+        std::size_t k = 0;
+        for (std::size_t i=0; i<in.num_times(); ++i) {
+            double t = in.time(i);
+            if (t<t0 || t>t1) continue;
+            while (k+2<nref && ref.time(k+1)<=t) ++k;
+            double dt = nref>1? ref.time(k+1)-ref.time(k): 0;
+            rows_.push_back(i);
+            ref_row_.push_back(k);
+            ref_weight_.push_back(dt>0? std::min((t-ref.time(k))/dt, 1.): 0.);
+        }
+    }
+
+    std::size_t num_rows() const { return rows_.size(); }
+    double time(std::size_t r) const { return in_.time(rows_[r]); }
+
+    // Error of row r, into e[0..np); scratch holds num_positions of REF.
+    void error_row(std::size_t r, float* __restrict e, float* __restrict scratch) const {
+        const float* __restrict a = in_.row(rows_[r]);
+        const std::size_t k = ref_row_[r];
+        const float w = ref_weight_[r];
+        const float* __restrict r0 = ref_.row(k);
+        const float* __restrict r1 = ref_.row(std::min(k+1, ref_.num_times()-1));
+
+        const std::size_t nref = ref_.num_positions();
+        for (std::size_t i=0; i<nref; ++i) {
+            scratch[i] = r0[i]+w*(r1[i]-r0[i]);
+        }
+
+        if (map_.identity) {
+            for (std::size_t j=0; j<np_; ++j) {
+                e[j] = a[j]-scratch[j];
+            }
+        }
+        else {
+            const std::uint32_t* __restrict idx = map_.index.data();
+            const float* __restrict wx = map_.weight.data();
+            for (std::size_t j=0; j<np_; ++j) {
+                float lo = scratch[idx[j]], hi = scratch[idx[j]+1];
+                e[j] = a[j]-(lo+wx[j]*(hi-lo));
+            }
+        }
+    }
+
+    // Rows [lo, hi) reduced into one output row: the signed error if a single
+    // row, else the maximum absolute error. Returns the maximum absolute
+    // error of the output row.
+    float error_bin(std::size_t lo, std::size_t hi, float* __restrict out,
+                    std::vector<float>& e, std::vector<float>& scratch, position_stats& stats) const
+    {
+        float* __restrict ev = e.data();
+        float* __restrict mx = stats.max_abs.data();
+        double* __restrict ss = stats.sum_sq.data();
+        for (std::size_t r=lo; r<hi; ++r) {
+            error_row(r, ev, scratch.data());
+            if (hi-lo==1) {
+                for (std::size_t j=0; j<np_; ++j) out[j] = ev[j];
+            }
+            else if (r==lo) {
+                for (std::size_t j=0; j<np_; ++j) out[j] = std::abs(ev[j]);
+            }
+            else {
+                for (std::size_t j=0; j<np_; ++j) out[j] = std::max(out[j], std::abs(ev[j]));
+            }
+            for (std::size_t j=0; j<np_; ++j) {
+                mx[j] = std::max(mx[j], std::abs(ev[j]));
+                ss[j] += double(ev[j])*ev[j];
+            }
+        }
+        stats.count += hi-lo;
+
+        float m = 0;
+        for (std::size_t j=0; j<np_; ++j) m = std::max(m, std::abs(out[j]));
+        return m;
+    }
+
+private:
+    const sup::mapped_dendrite_matrix& in_;
+    const sup::mapped_dendrite_matrix& ref_;
+    position_map map_;
+    std::size_t np_;
+
+    std::vector<std::size_t> rows_;
+    std::vector<std::size_t> ref_row_;
+    std::vector<double> ref_weight_;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string input, reference, output = "error.nc";
+    unsigned njobs = std::max(1u, std::thread::hardware_concurrency());
+    double bin = 0;
+
+    for (int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i+1<argc;
+        if (arg=="-h" || arg=="--help") {
+            std::cout << usage_str;
+            return 0;
+        }
+        else if (arg=="-r" && has_value) {
+            reference = argv[++i];
+        }
+        else if (arg=="-o" && has_value) {
+            output = argv[++i];
+        }
+        else if (arg=="-j" && has_value) {
+            njobs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg=="-b" && has_value) {
+            bin = std::atof(argv[++i]);
+        }
+        else if (input.empty() && arg[0]!='-') {
+            input = arg;
+        }
+        else {
+            std::cerr << usage_str;
+            return 2;
+        }
+    }
+    if (input.empty() || reference.empty() || bin<0) {
+        std::cerr << usage_str;
+        return 2;
+    }
+
+    try {
+        const auto t_start = clock_type::now();
+        sup::mapped_dendrite_matrix in(input);
+        sup::mapped_dendrite_matrix ref(reference);
+        comparison cmp(in, ref);
+
+        const std::size_t np = in.num_positions();
+        const std::size_t nrows = cmp.num_rows();
+        if (!np || !nrows) {
+            throw std::runtime_error("no samples of "+input+" in the time range of "+reference);
+        }
+
+        // Output rows as ranges of input rows: one each, or one per time bin.
+        std::vector<std::size_t> bin_start;
+        for (std::size_t r=0; r<nrows; ++r) {
+            if (bin_start.empty() || !(bin>0) ||
+                std::floor(cmp.time(r)/bin)!=std::floor(cmp.time(bin_start.back())/bin))
+            {
+                bin_start.push_back(r);
+            }
+        }
+        const std::size_t nbins = bin_start.size();
+        bin_start.push_back(nrows);
+
+        sup::netcdf_writer nc(output);
+        nc.add_attribute("title", "dendritic voltage error map");
+        nc.add_attribute("input", input);
+        nc.add_attribute("reference", reference);
+        auto dtime = nc.add_dimension("time", nbins);
+        auto dpos = nc.add_dimension("position", np);
+
+        auto vtime = nc.add_variable("time", sup::netcdf_file::nc_double, {dtime});
+        nc.add_attribute(vtime, "units", "ms");
+        if (bin>0) nc.add_attribute(vtime, "long_name", "start of time bin");
+        auto vpos = nc.add_variable("position", sup::netcdf_file::nc_double, {dpos});
+        nc.add_attribute(vpos, "long_name", "position as a fraction of the dendrite length");
+        auto vmaxt = nc.add_variable("max_error_time", sup::netcdf_file::nc_float, {dtime});
+        nc.add_attribute(vmaxt, "units", in.units());
+        auto vmaxp = nc.add_variable("max_error", sup::netcdf_file::nc_float, {dpos});
+        nc.add_attribute(vmaxp, "units", in.units());
+        auto vrms = nc.add_variable("rms_error", sup::netcdf_file::nc_float, {dpos});
+        nc.add_attribute(vrms, "units", in.units());
+        // Last, since it may exceed the 4 GiB limit of other variables.
+        auto verr = nc.add_variable("error", sup::netcdf_file::nc_float, {dtime, dpos});
+        nc.add_attribute(verr, "units", in.units());
+        nc.add_attribute(verr, "long_name", bin>0? "maximum absolute error in time bin": "input - reference");
+        nc.write_header();
+
+        std::vector<double> times;
+        for (std::size_t b=0; b<nbins; ++b) {
+            double t = cmp.time(bin_start[b]);
+            times.push_back(bin>0? std::floor(t/bin)*bin: t);
+        }
+        nc.write(vtime, times.data(), nbins);
+        nc.write(vpos, in.positions().data(), np);
+
+        // Bins are computed in blocks that are written out in turn, with the
+        // bins of a block split evenly among the threads.
+        const std::size_t block = std::max<std::size_t>(njobs, (std::size_t(1)<<24)/np);
+        std::vector<float> out(std::min(block, nbins)*np);
+        std::vector<float> max_time(nbins);
+        std::vector<position_stats> stats(njobs, position_stats(np));
+
+        for (std::size_t b0=0; b0<nbins; b0+=block) {
+            const std::size_t b1 = std::min(b0+block, nbins);
+            std::vector<std::thread> threads;
+            for (unsigned t=0; t<njobs; ++t) {
+                threads.emplace_back([&, t]() {
+                    std::vector<float> e(np), scratch(ref.num_positions());
+                    std::size_t lo = b0+(b1-b0)*t/njobs, hi = b0+(b1-b0)*(t+1)/njobs;
+                    for (std::size_t b=lo; b<hi; ++b) {
+                        max_time[b] = cmp.error_bin(bin_start[b], bin_start[b+1],
+                            out.data()+(b-b0)*np, e, scratch, stats[t]);
+                    }
+                });
+            }
+            for (auto& t: threads) t.join();
+            nc.write(verr, out.data(), (b1-b0)*np);
+        }
+
+        for (unsigned t=1; t<njobs; ++t) stats[0].merge(stats[t]);
+        std::vector<float> rms(np);
+        for (std::size_t j=0; j<np; ++j) rms[j] = std::sqrt(stats[0].sum_sq[j]/stats[0].count);
+
+        nc.write(vmaxt, max_time.data(), nbins);
+        nc.write(vmaxp, stats[0].max_abs.data(), np);
+        nc.write(vrms, rms.data(), np);
+        nc.close();
+
+        auto worst = std::max_element(stats[0].max_abs.begin(), stats[0].max_abs.end())-stats[0].max_abs.begin();
+        auto worst_t = std::max_element(max_time.begin(), max_time.end())-max_time.begin();
+        std::cout << nrows << " samples x " << np << " positions, " << njobs << " threads, "
+                  << seconds_since(t_start) << " s\n"
+                  << "max error " << stats[0].max_abs[worst] << " " << in.units()
+                  << " at position " << in.positions()[worst] << ", time " << times[worst_t] << " ms\n";
+    }
+    catch (std::exception& e) {
+        std::cerr << "dendcompare: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simple_sampler.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+#include "trace_features.hpp"
+
+namespace {
+
+double seconds_since(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-t).count();
+}
+
+// Maximum absolute difference from a reference, interpolated at sample times.
+double max_abs_error(const arb::trace_data<double>& trace, const arb::trace_data<double>& reference) {
+    trace_interpolator ref(reference);
+    double err = 0;
+    for (const auto& s: trace) {
+        err = std::max(err, std::abs(s.v-ref(s.t)));
+    }
+    return err;
+}
+
+// A trace sampled on the rank that owns its cell, on every rank.
+arb::trace_data<double> share_trace(const arb::trace_data<double>& local) {
+    const unsigned n = global_max(unsigned(local.size()));
+    std::vector<double> t(n, 0.), v(n, 0.);
+    for (std::size_t i=0; i<local.size(); ++i) {
+        t[i] = local[i].t;
+        v[i] = local[i].v;
+    }
+    global_sum(t);
+    global_sum(v);
+
+    arb::trace_data<double> trace;
+    for (unsigned i=0; i<n; ++i) trace.push_back({t[i], v[i]});
+    return trace;
+}
+
+// The compartment counts from finest down to coarsest, each at most the
+// previous divided by ratio.
+std::vector<unsigned> ladder(unsigned finest, unsigned coarsest, double ratio) {
+    std::vector<unsigned> counts = {finest};
+    while (counts.back()>coarsest) {
+        unsigned n = std::floor(counts.back()/ratio);
+        counts.push_back(std::max(coarsest, std::min(n, counts.back()-1)));
+    }
+    return counts;
+}
+
+} // namespace
+
+int run_discretization(const arb::context& context, const single_options& options,
+                       const single_params& params, arb::profile::meter_manager& meters)
+{
+    const bool root = arb::rank(context)==0;
+    const auto& d = params.discretization;
+
+    auto sched = make_sample_schedule(params, input_event_times());
+
+    // Soma trace of the finest count, and the RMS and maximum error of each
+    // count evaluated so far against it.
+    arb::trace_data<double> reference;
+    std::map<unsigned, std::pair<double, double>> errors;
+    std::map<unsigned, unsigned> round_of;
+    auto passes = [&](unsigned n) { return errors.at(n).first<=d.tolerance; };
+
+    nlohmann::json out;
+    out["finest"] = d.finest;
+    out["tolerance"] = d.tolerance;
+    auto& jrounds = out["rounds"] = nlohmann::json::array();
+
+    if (root) {
+        std::cout << std::setw(6) << "round" << std::setw(12) << "candidates"
+                  << std::setw(12) << "init(s)" << std::setw(12) << "run(s)" << "\n";
+    }
+
+    // Run the counts together as the gids of one simulation, in order, and
+    // record their errors. In the first round, gid 0 is the finest count and
+    // provides the reference.
+    auto run_round = [&](const std::vector<unsigned>& counts) {
+        const unsigned round = jrounds.size();
+        const std::string label = "round"+std::to_string(round);
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<single_params> cells(counts.size(), params);
+        for (std::size_t i=0; i<counts.size(); ++i) {
+            cells[i].dend_compartments = counts[i];
+        }
+        soma_recipe recipe(cells, input_seeding::shared);
+        auto decomp = arb::partition_load_balance(recipe, context);
+        arb::simulation sim(recipe, decomp, context);
+
+        std::vector<arb::trace_data<double>> traces(counts.size());
+        for (cell_gid_type gid=0; gid<counts.size(); ++gid) {
+            sim.add_sampler(arb::one_probe({gid, 0}), sched, arb::make_simple_sampler(traces[gid]));
+        }
+        const double t_init = seconds_since(t0);
+        meters.checkpoint("model-init-"+label, context);
+
+        t0 = std::chrono::steady_clock::now();
+        sim.run(params.tstop, params.dt);
+        const double t_run = seconds_since(t0);
+        meters.checkpoint("model-run-"+label, context);
+
+        if (round==0) {
+            reference = share_trace(traces[0]);
+        }
+
+        // Errors on the rank that owns each cell, then summed over ranks.
+        std::vector<double> table(2*counts.size(), 0.);
+        for (std::size_t i=0; i<counts.size(); ++i) {
+            if (traces[i].empty()) continue;
+            table[2*i] = rms_error(traces[i], reference);
+            table[2*i+1] = max_abs_error(traces[i], reference);
+        }
+        global_sum(table);
+        for (std::size_t i=0; i<counts.size(); ++i) {
+            errors[counts[i]] = {table[2*i], table[2*i+1]};
+            round_of[counts[i]] = round;
+        }
+
+        nlohmann::json jr;
+        jr["compartments"] = counts;
+        jr["init"] = t_init;
+        jr["run"] = t_run;
+        jrounds.push_back(jr);
+
+        if (root) {
+            std::cout << std::setw(6) << round << std::setw(12) << counts.size()
+                      << std::setw(12) << t_init << std::setw(12) << t_run << std::endl;
+        }
+    };
+
+    // The ladder brackets the answer between the coarsest count that passes
+    // with every finer count of the ladder (hi), and the next coarser (lo).
+    auto rungs = ladder(d.finest, d.coarsest, d.ratio);
+    run_round(rungs);
+
+    unsigned hi = rungs[0];
+    unsigned lo = 0;
+    for (auto n: rungs) {
+        if (!passes(n)) {
+            lo = n;
+            break;
+        }
+        hi = n;
+    }
+
+    // Then each round tries up to parallel counts evenly spaced strictly
+    // between lo and hi, and narrows the bracket to the first passing count
+    // and the count below it, assuming the error falls as the count rises.
+    while (lo && hi-lo>1) {
+        const unsigned m = std::min(d.parallel, hi-lo-1);
+        std::vector<unsigned> counts;
+        for (unsigned i=1; i<=m; ++i) {
+            unsigned n = lo+(unsigned long long)(hi-lo)*i/(m+1);
+            if (n>lo && n<hi && (counts.empty() || n>counts.back())) counts.push_back(n);
+        }
+        run_round(counts);
+
+        for (auto n: counts) {
+            if (passes(n)) {
+                hi = n;
+                break;
+            }
+            lo = n;
+        }
+    }
+
+    if (!root) return 0;
+
+    auto& jc = out["candidates"] = nlohmann::json::array();
+    std::cout << "\n" << std::setw(14) << "compartments" << std::setw(14) << "rmse"
+              << std::setw(14) << "max error" << std::setw(8) << "round" << "\n";
+    for (auto& e: errors) {
+        nlohmann::json j;
+        j["compartments"] = e.first;
+        j["rmse"] = e.second.first;
+        j["max_error"] = e.second.second;
+        j["round"] = round_of[e.first];
+        jc.push_back(j);
+
+        std::cout << std::setw(14) << e.first << std::setw(14) << e.second.first
+                  << std::setw(14) << e.second.second << std::setw(8) << round_of[e.first]
+                  << (e.first==hi? "  <-": "") << "\n";
+    }
+
+    out["compartments"] = hi;
+    out["rmse"] = errors.at(hi).first;
+    out["max_error"] = errors.at(hi).second;
+    std::cout << "\n" << hi << " compartments are within " << d.tolerance
+              << " mV RMS of " << d.finest << " compartments\n";
+
+    std::string path = options.results_file.empty()? "discretization.json": options.results_file;
+    std::ofstream file(path);
+    file << std::setw(1) << out << "\n";
+
+    return 0;
+}
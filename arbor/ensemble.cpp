@@ -0,0 +1,107 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "ensemble_stats.hpp"
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "single_recipe.hpp"
+
+int run_ensemble(const arb::context& context, const single_options& options,
+                 const single_params& params, arb::profile::meter_manager& meters)
+{
+    const bool root = arb::rank(context)==0;
+    const auto& e = params.ensemble;
+
+    // Every gid is a trial: the same cell, with its own input seed.
+    std::vector<single_params> cells(e.trials, params);
+    soma_recipe recipe(cells);
+    auto decomp = arb::partition_load_balance(recipe, context);
+    arb::simulation sim(recipe, decomp, context);
+
+    // The soma voltage of all trials is sampled regularly into one
+    // accumulator; Poisson input has no event times to window around.
+    ensemble_accumulator stats(e.bin>0? e.bin: params.sampling.dt, params.tstop);
+    sim.add_sampler([](cell_member_type id) { return id.index==0; },
+                    arb::regular_schedule(params.sampling.dt), stats.sampler());
+
+    meters.checkpoint("model-init", context);
+
+    if (root) {
+        std::cout << "running " << e.trials << " trials at " << e.rate << " Hz input, "
+                  << stats.num_bins() << " bins of " << stats.bin() << " ms" << std::endl;
+    }
+    sim.run(params.tstop, params.dt);
+
+    meters.checkpoint("model-run", context);
+
+    // Merge over the threads of each rank, then over ranks on the root.
+    const std::size_t nbins = stats.num_bins();
+    const unsigned partials = stats.num_partials();
+    std::vector<double> local;
+    local.reserve(5*nbins);
+    for (auto& s: stats.merged()) {
+        local.insert(local.end(), {s.n, s.mean, s.m2, s.min, s.max});
+    }
+    auto all = gather(local);
+    const unsigned max_partials = global_max(partials);
+
+    if (!root) return 0;
+
+    std::vector<running_stats> bins(nbins);
+    for (std::size_t r=0; r<all.size()/(5*nbins); ++r) {
+        const double* x = all.data()+5*nbins*r;
+        for (std::size_t b=0; b<nbins; ++b, x+=5) {
+            running_stats s;
+            s.n = x[0];
+            s.mean = x[1];
+            s.m2 = x[2];
+            s.min = x[3];
+            s.max = x[4];
+            bins[b].merge(s);
+        }
+    }
+
+    nlohmann::json out;
+    out["trials"] = e.trials;
+    out["rate"] = e.rate;
+    out["seed"] = e.seed;
+    out["bin"] = stats.bin();
+    out["spike_count"] = sim.num_spikes();
+    auto& jt = out["time"] = nlohmann::json::array();
+    auto& jn = out["n"] = nlohmann::json::array();
+    auto& jmean = out["mean"] = nlohmann::json::array();
+    auto& jvar = out["variance"] = nlohmann::json::array();
+    auto& jmin = out["min"] = nlohmann::json::array();
+    auto& jmax = out["max"] = nlohmann::json::array();
+    for (std::size_t b=0; b<nbins; ++b) {
+        const auto& s = bins[b];
+        jt.push_back(b*stats.bin());
+        jn.push_back(s.n);
+        jmean.push_back(s.n? s.mean: NAN);
+        jvar.push_back(s.variance());
+        jmin.push_back(s.n? s.min: NAN);
+        jmax.push_back(s.n? s.max: NAN);
+    }
+
+    std::cout << "\n" << sim.num_spikes() << " spikes, "
+              << 1000.*sim.num_spikes()/(e.trials*params.tstop) << " Hz per trial; "
+              << "statistics of " << nbins << " bins kept by up to " << max_partials << " threads per rank\n";
+
+    std::string path = options.results_file.empty()? "ensemble.json": options.results_file;
+    std::ofstream file(path);
+    file << out << "\n";
+
+    return 0;
+}
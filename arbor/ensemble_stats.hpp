@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <arbor/common_types.hpp>
+#include <arbor/sampling.hpp>
+
+// Running statistics of a set of values: the count, the mean and the sum of
+// squared deviations from the mean, updated one value at a time (Welford),
+// and the extremes.
+struct running_stats {
+    double n = 0;
+    double mean = 0;
+    double m2 = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void add(double x) {
+        n += 1;
+        double d = x-mean;
+        mean += d/n;
+        m2 += d*(x-mean);
+        min = std::min(min, x);
+        max = std::max(max, x);
+    }
+
+    // Combine with the statistics of a disjoint set (Chan, Golub and LeVeque).
+    void merge(const running_stats& o) {
+        if (o.n==0) return;
+        if (n==0) {
+            *this = o;
+            return;
+        }
+        double total = n+o.n;
+        double d = o.mean-mean;
+        mean += d*o.n/total;
+        m2 += o.m2 + d*d*n*o.n/total;
+        n = total;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+    }
+
+    // Sample variance.
+    double variance() const {
+        return n>1? m2/(n-1): NAN;
+    }
+};
+
+// Statistics of the samples of many trials in each bin of time, from a
+// sampler that is shared by all of them.
+//
+// Each thread that delivers samples updates bins of its own, so that the
+// sampler needs a lock only to find them; the threads' bins are merged once
+// the run is over. Memory grows with the number of threads, not of trials.
+class ensemble_accumulator {
+public:
+    ensemble_accumulator(double bin, double tstop):
+        bin_(bin), num_bins_(std::max<std::size_t>(1, std::ceil(tstop/bin)))
+    {}
+
+    ensemble_accumulator(const ensemble_accumulator&) = delete;
+    ensemble_accumulator& operator=(const ensemble_accumulator&) = delete;
+
+    // The accumulator must outlive the simulation the sampler is attached to.
+    arb::sampler_function sampler() {
+        return [this](arb::cell_member_type, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+            auto& bins = thread_bins();
+            for (std::size_t i=0; i<n; ++i) {
+                if (auto p = arb::util::any_cast<const double*>(recs[i].data)) {
+                    std::size_t b = recs[i].time/bin_;
+                    bins[std::min(b, num_bins_-1)].add(*p);
+                }
+            }
+        };
+    }
+
+    double bin() const { return bin_; }
+    std::size_t num_bins() const { return num_bins_; }
+    std::size_t num_partials() const { return partials_.size(); }
+
+    // The bins of all threads merged; not to be called during a run.
+    std::vector<running_stats> merged() const {
+        std::vector<running_stats> bins(num_bins_);
+        for (auto& p: partials_) {
+            for (std::size_t b=0; b<num_bins_; ++b) bins[b].merge(p.second[b]);
+        }
+        return bins;
+    }
+
+private:
+    double bin_;
+    std::size_t num_bins_;
+    std::mutex mutex_;
+    // Elements of a map stay put as others are added.
+    std::map<std::thread::id, std::vector<running_stats>> partials_;
+
+    std::vector<running_stats>& thread_bins() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& bins = partials_[std::this_thread::get_id()];
+        if (bins.empty()) bins.resize(num_bins_);
+        return bins;
+    }
+};
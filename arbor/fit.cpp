@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simple_sampler.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+#include "trace_features.hpp"
+#include "trace_io.hpp"
+
+namespace {
+
+// Spike distance penalty for each spike missing from, or extra to, the
+// reference train (ms).
+constexpr double unpaired_spike_penalty = 20;
+
+using candidate = std::vector<double>;
+
+// Score every candidate by running them as the gids of one simulation.
+// The context and domain decomposition are shared by all generations: the
+// population size, and so the recipe shape, is fixed, and only the
+// parameters of each gid change.
+class population_evaluator {
+public:
+    population_evaluator(const arb::context& context, const single_params& params,
+                         arb::trace_data<double> reference):
+        context_(context), params_(params), reference_(std::move(reference)),
+        recipe_(std::vector<single_params>(params.fit.population, params), input_seeding::shared),
+        decomp_(arb::partition_load_balance(recipe_, context))
+    {
+        reference_spikes_ = threshold_crossings(reference_, params_.spike_threshold);
+    }
+
+    std::vector<double> operator()(const std::vector<candidate>& population) {
+        const auto& names = params_.fit.params;
+        const std::size_t n = population.size();
+
+        std::vector<single_params> cells(n, params_);
+        for (std::size_t i=0; i<n; ++i) {
+            for (std::size_t k=0; k<names.size(); ++k) {
+                *cell_param(cells[i], names[k]) = population[i][k];
+            }
+        }
+
+        // Cell parameters are fixed once a simulation is built, so each
+        // generation gets a new simulation over the same decomposition.
+        recipe_ = soma_recipe(cells, input_seeding::shared);
+        arb::simulation sim(recipe_, decomp_, context_);
+
+        auto sched = make_sample_schedule(params_, input_event_times());
+        std::vector<arb::trace_data<double>> traces(n);
+        for (cell_gid_type gid=0; gid<n; ++gid) {
+            sim.add_sampler(arb::one_probe({gid, 0}), sched, arb::make_simple_sampler(traces[gid]));
+        }
+        sim.run(params_.tstop, params_.dt);
+
+        // Score on the rank that owns each cell, then gather.
+        std::vector<double> scores(n, 0.);
+        for (cell_gid_type gid=0; gid<n; ++gid) {
+            if (traces[gid].empty()) continue;
+            auto spikes = threshold_crossings(traces[gid], cells[gid].spike_threshold);
+            scores[gid] = rms_error(traces[gid], reference_)
+                + params_.fit.spike_weight*spike_distance(spikes, reference_spikes_, unpaired_spike_penalty);
+        }
+        global_sum(scores);
+
+        // A candidate that drives the cell unstable scores worst.
+        for (auto& s: scores) {
+            if (!std::isfinite(s)) s = std::numeric_limits<double>::infinity();
+        }
+        return scores;
+    }
+
+private:
+    const arb::context& context_;
+    single_params params_;
+    arb::trace_data<double> reference_;
+    std::vector<double> reference_spikes_;
+    soma_recipe recipe_;
+    arb::domain_decomposition decomp_;
+};
+
+} // namespace
+
+int run_fit(const arb::context& context, const single_options& options,
+            const single_params& params, arb::profile::meter_manager& meters)
+{
+    using clock = std::chrono::steady_clock;
+
+    const bool root = arb::rank(context)==0;
+    const auto& fit = params.fit;
+    const auto& names = fit.params;
+    if (names.empty()) {
+        throw std::runtime_error("fit: no parameters selected");
+    }
+    if (options.reference_file.empty()) {
+        throw std::runtime_error("fit: a reference trace is required (--reference)");
+    }
+
+    const std::size_t np = fit.population;
+    const std::size_t dim = names.size();
+
+    population_evaluator evaluate(context, params, read_trace(options.reference_file));
+
+    meters.checkpoint("model-init", context);
+
+    // Differential evolution, DE/rand/1/bin. Every rank draws the same
+    // sequence from the shared seed, so populations agree without exchange.
+    std::mt19937 rng(fit.seed);
+    std::uniform_real_distribution<double> U(0., 1.);
+    std::uniform_int_distribution<std::size_t> pick(0, np-1);
+    std::uniform_int_distribution<std::size_t> pick_dim(0, dim-1);
+
+    auto clamp = [&](double x, std::size_t k) {
+        return std::min(std::max(x, fit.bounds[k][0]), fit.bounds[k][1]);
+    };
+
+    std::vector<candidate> population(np, candidate(dim));
+    for (auto& x: population) {
+        for (std::size_t k=0; k<dim; ++k) {
+            x[k] = fit.bounds[k][0] + U(rng)*(fit.bounds[k][1]-fit.bounds[k][0]);
+        }
+    }
+    auto scores = evaluate(population);
+
+    auto best_index = [&]() {
+        return std::size_t(std::min_element(scores.begin(), scores.end())-scores.begin());
+    };
+
+    nlohmann::json history = nlohmann::json::array();
+    auto report = [&](unsigned gen, double seconds) {
+        auto b = best_index();
+        history.push_back({{"generation", gen}, {"best_score", scores[b]}, {"seconds", seconds}});
+        if (root) {
+            std::cout << "generation " << std::setw(4) << gen
+                      << "  best score " << std::setw(12) << scores[b]
+                      << "  (" << std::fixed << std::setprecision(2) << seconds << " s)"
+                      << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+    };
+    report(0, 0);
+
+    for (unsigned gen=1; gen<=fit.generations; ++gen) {
+        auto t0 = clock::now();
+
+        std::vector<candidate> trials(np, candidate(dim));
+        for (std::size_t i=0; i<np; ++i) {
+            std::size_t a, b, c;
+            do a = pick(rng); while (a==i);
+            do b = pick(rng); while (b==i || b==a);
+            do c = pick(rng); while (c==i || c==a || c==b);
+
+            std::size_t forced = pick_dim(rng);
+            for (std::size_t k=0; k<dim; ++k) {
+                bool cross = k==forced || U(rng)<fit.CR;
+                trials[i][k] = cross?
+                    clamp(population[a][k] + fit.F*(population[b][k]-population[c][k]), k):
+                    population[i][k];
+            }
+        }
+
+        auto trial_scores = evaluate(trials);
+        for (std::size_t i=0; i<np; ++i) {
+            if (trial_scores[i]<=scores[i]) {
+                population[i] = trials[i];
+                scores[i] = trial_scores[i];
+            }
+        }
+
+        report(gen, std::chrono::duration<double>(clock::now()-t0).count());
+    }
+
+    meters.checkpoint("model-run", context);
+
+    if (!root) return 0;
+
+    const auto& best = population[best_index()];
+
+    // The fitted parameter set, ready to run in single mode.
+    nlohmann::json fitted;
+    {
+        std::ifstream f(options.params_file);
+        f >> fitted;
+    }
+    fitted.erase("mode");
+    fitted.erase("fit");
+
+    nlohmann::json out;
+    out["best_score"] = scores[best_index()];
+    std::cout << "\n" << std::setw(16) << "parameter" << std::setw(14) << "value" << "\n";
+    for (std::size_t k=0; k<dim; ++k) {
+        out["best"][names[k]] = best[k];
+        fitted[names[k]] = best[k];
+        std::cout << std::setw(16) << names[k] << std::setw(14) << best[k] << "\n";
+    }
+    out["history"] = history;
+    out["params"] = fitted;
+
+    std::string path = options.results_file.empty()? "fit.json": options.results_file;
+    std::ofstream file(path);
+    file << std::setw(1) << out << "\n";
+
+    return 0;
+}
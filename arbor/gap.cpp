@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simple_sampler.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+
+namespace {
+
+// Copies of the validation cell with gap junction sites on the dendrite:
+// site 0 couples to the previous cell in the chain or row, site 1 to the
+// next, and in a lattice site 2 to the cell above and site 3 to the cell
+// below. Cells coupled by gap junctions must be in the same cell group, so
+// a chain or lattice is partitioned as a single group.
+class gap_recipe: public soma_recipe {
+public:
+    gap_recipe(const single_params& params, unsigned ncells):
+        soma_recipe(std::vector<single_params>(ncells, params)),
+        params_(params), ncells_(ncells),
+        width_(params.gap.topology=="lattice"? params.gap.width: ncells)
+    {}
+
+    arb::util::unique_any get_cell_description(cell_gid_type gid) const override {
+        auto cell = single_cell(params_);
+        for (cell_size_type i=0; i<num_gap_junction_sites(gid); ++i) {
+            cell.add_gap_junction({1, params_.gap.location});
+        }
+        return arb::util::unique_any(std::move(cell));
+    }
+
+    cell_size_type num_gap_junction_sites(cell_gid_type gid) const override {
+        return params_.gap.topology=="lattice"? 4: 2;
+    }
+
+    std::vector<arb::gap_junction_connection> gap_junctions_on(cell_gid_type gid) const override {
+        const double g = params_.gap.ggap;
+        const cell_gid_type col = gid%width_;
+        std::vector<arb::gap_junction_connection> conns;
+        if (col>0) conns.push_back({{gid, 0}, {gid-1, 1}, g});
+        if (col+1<width_ && gid+1<ncells_) conns.push_back({{gid, 1}, {gid+1, 0}, g});
+        if (gid>=width_) conns.push_back({{gid, 2}, {gid-width_, 3}, g});
+        if (gid+width_<ncells_) conns.push_back({{gid, 3}, {gid+width_, 2}, g});
+        return conns;
+    }
+
+    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
+        if (gid<params_.gap.stimulated) return soma_recipe::event_generators(gid);
+        return {};
+    }
+
+private:
+    single_params params_;
+    cell_gid_type ncells_;
+    cell_gid_type width_;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-t).count();
+}
+
+nlohmann::json trace_json(const arb::trace_data<double>& trace, cell_gid_type gid) {
+    nlohmann::json json;
+    json["name"] = "arbor gap";
+    json["units"] = "mV";
+    json["cell"] = std::to_string(gid)+".0";
+    json["probe"] = "0";
+    auto& jt = json["data"]["time"] = nlohmann::json::array();
+    auto& jv = json["data"]["voltage"] = nlohmann::json::array();
+    for (const auto& s: trace) {
+        jt.push_back(s.t);
+        jv.push_back(s.v);
+    }
+    return json;
+}
+
+} // namespace
+
+int run_gap(const arb::context& context, const single_options& options,
+            const single_params& params, arb::profile::meter_manager& meters)
+{
+    const bool root = arb::rank(context)==0;
+    const auto& gap = params.gap;
+    auto sizes = gap.sizes;
+    std::sort(sizes.begin(), sizes.end());
+
+    nlohmann::json out;
+    out["topology"] = gap.topology;
+    out["ggap"] = gap.ggap;
+    auto& jsizes = out["sizes"] = nlohmann::json::array();
+    nlohmann::json traces = nlohmann::json::array();
+
+    if (root) {
+        std::cout << std::setw(8) << "cells" << std::setw(8) << "groups" << std::setw(10) << "largest"
+                  << std::setw(12) << "init(s)" << std::setw(12) << "run(s)" << std::setw(10) << "spikes" << "\n";
+    }
+    for (auto n: sizes) {
+        const std::string label = std::to_string(n);
+
+        auto t0 = std::chrono::steady_clock::now();
+        gap_recipe recipe(params, n);
+        auto decomp = arb::partition_load_balance(recipe, context);
+        arb::simulation sim(recipe, decomp, context);
+        const double init_time = seconds_since(t0);
+        meters.checkpoint("model-init-"+label, context);
+
+        // Soma traces of the first and last cells; those of cells on other
+        // ranks than the root are not written.
+        const bool last = n==sizes.back();
+        arb::trace_data<double> first_trace, last_trace;
+        if (last) {
+            auto sched = make_sample_schedule(params, input_event_times());
+            sim.add_sampler(arb::one_probe({0, 0}), sched, arb::make_simple_sampler(first_trace));
+            if (n>1) sim.add_sampler(arb::one_probe({n-1, 0}), sched, arb::make_simple_sampler(last_trace));
+        }
+
+        t0 = std::chrono::steady_clock::now();
+        sim.run(params.tstop, params.dt);
+        const double run_time = seconds_since(t0);
+        meters.checkpoint("model-run-"+label, context);
+
+        unsigned largest = 0;
+        for (auto& g: decomp.groups) largest = std::max<unsigned>(largest, g.gids.size());
+        largest = global_max(largest);
+        std::vector<double> totals = {double(decomp.groups.size()), init_time, run_time};
+        global_sum(totals);
+        const unsigned nranks = arb::num_ranks(context);
+
+        if (last && root) {
+            if (!first_trace.empty()) traces.push_back(trace_json(first_trace, 0));
+            if (!last_trace.empty()) traces.push_back(trace_json(last_trace, n-1));
+        }
+        if (!root) continue;
+
+        // Times are the means over ranks.
+        nlohmann::json j;
+        j["cells"] = n;
+        j["groups"] = totals[0];
+        j["largest_group"] = largest;
+        j["init_time"] = totals[1]/nranks;
+        j["run_time"] = totals[2]/nranks;
+        j["spikes"] = sim.num_spikes();
+        jsizes.push_back(j);
+
+        std::cout << std::setw(8) << n << std::setw(8) << totals[0] << std::setw(10) << largest
+                  << std::setw(12) << totals[1]/nranks << std::setw(12) << totals[2]/nranks
+                  << std::setw(10) << sim.num_spikes() << std::endl;
+    }
+
+    if (!root) return 0;
+
+    std::string path = options.results_file.empty()? "gap.json": options.results_file;
+    std::ofstream file(path);
+    file << std::setw(1) << out << "\n";
+
+    // The traces are written as a list of traces in the single run format,
+    // the same as test_single.py writes for the gap mode.
+    std::ofstream trace_file(options.trace_file);
+    trace_file << std::setw(1) << traces << "\n";
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <arbor/common_types.hpp>
+#include <arbor/event_generator.hpp>
+#include <arbor/schedule.hpp>
+#include <arbor/spike_event.hpp>
+
+#include <common/spike_trains.hpp>
+
+#include "parameters.hpp"
+
+// Event generators for synaptic inputs that are not held in memory.
+
+// Passes on the events of another generator, counting them into a counter
+// shared by all copies. Arbor asks each generator for the events of every
+// epoch once, so the count is that of the events delivered.
+class counting_generator {
+public:
+    using counter = std::shared_ptr<std::atomic<std::uint64_t>>;
+
+    counting_generator(arb::event_generator gen, counter count):
+        gen_(std::move(gen)), count_(std::move(count))
+    {}
+
+    void reset() {
+        gen_.reset();
+    }
+
+    arb::event_seq events(arb::time_type t0, arb::time_type t1) {
+        auto seq = gen_.events(t0, t1);
+        *count_ += seq.second-seq.first;
+        return seq;
+    }
+
+private:
+    arb::event_generator gen_;
+    counter count_;
+};
+
+// Events of one train of a memory-mapped spike train file. Only the events
+// of the window asked for are materialized, so memory is bounded by the
+// events of one epoch; the generator holds a reference to the file.
+class mapped_train_generator {
+public:
+    mapped_train_generator(arb::cell_member_type target, float weight,
+                           std::shared_ptr<const sup::mapped_spike_trains> file,
+                           const sup::mapped_spike_trains::train& train):
+        target_(target), weight_(weight), file_(std::move(file)),
+        begin_(train.begin), end_(train.end), next_(train.begin)
+    {}
+
+    void reset() {
+        next_ = begin_;
+    }
+
+    // Events in [t0, t1). Windows usually follow each other, so the search
+    // for t0 starts from the end of the previous window.
+    arb::event_seq events(arb::time_type t0, arb::time_type t1) {
+        const double* from = next_!=begin_ && *(next_-1)<t0? next_: begin_;
+        const double* lo = std::lower_bound(from, end_, t0);
+        const double* hi = std::lower_bound(lo, end_, t1);
+        next_ = hi;
+
+        events_.clear();
+        for (auto t = lo; t!=hi; ++t) {
+            events_.push_back({target_, *t, weight_});
+        }
+        return {events_.data(), events_.data()+events_.size()};
+    }
+
+private:
+    arb::cell_member_type target_;
+    float weight_;
+    std::shared_ptr<const sup::mapped_spike_trains> file_;
+    const double* begin_;
+    const double* end_;
+    const double* next_;
+    std::vector<arb::spike_event> events_;
+};
+
+// A schedule cut off at a stop time.
+class stopped_schedule {
+public:
+    stopped_schedule(arb::schedule sched, arb::time_type stop):
+        sched_(std::move(sched)), stop_(stop)
+    {}
+
+    void reset() {
+        sched_.reset();
+    }
+
+    arb::time_event_span events(arb::time_type t0, arb::time_type t1) {
+        if (t0>=stop_) return {nullptr, nullptr};
+        return sched_.events(t0, std::min(t1, stop_));
+    }
+
+private:
+    arb::schedule sched_;
+    arb::time_type stop_;
+};
+
+// The generator of an input to a target of a cell. Arbor's Poisson and
+// regular schedules produce events lazily for each window they are asked
+// for, and the random stream is seeded from (seed, seed_gid, target) only,
+// so the events do not depend on the number of threads or ranks. Cells
+// given the same seed_gid get the same events.
+inline arb::event_generator make_input_generator(const input_spec& in, arb::cell_gid_type gid,
+                                                 arb::cell_gid_type seed_gid)
+{
+    arb::schedule sched;
+    if (in.type=="poisson") {
+        std::seed_seq seq{in.seed, seed_gid, in.target};
+        std::mt19937_64 rng(seq);
+        sched = arb::poisson_schedule(in.start, in.rate/1000, rng);
+    }
+    else {
+        sched = arb::regular_schedule(in.start, 1000/in.rate);
+    }
+    return arb::schedule_generator({gid, in.target}, float(in.weight),
+                                   arb::schedule(stopped_schedule(std::move(sched), in.stop)));
+}
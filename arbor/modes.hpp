@@ -0,0 +1,71 @@
+#pragma once
+
+#include <arbor/context.hpp>
+#include <arbor/profile/meter_manager.hpp>
+
+#include "affinity.hpp"
+#include "parameters.hpp"
+
+// Analysis modes of single, selected by the "mode" parameter. Each builds and
+// runs its own simulation on the given context, records its meter
+// checkpoints, writes its results on the root rank, and returns the exit
+// status of the program.
+
+// Central finite-difference sensitivities of trace features to the cell
+// parameters listed in the "sensitivity" section. The baseline and the
+// perturbed cells run together as the gids of one simulation.
+int run_sensitivity(const arb::context& context, const single_options& options,
+                    const single_params& params, arb::profile::meter_manager& meters);
+
+// Differential evolution fit of the cell parameters bounded in the "fit"
+// section to the --reference trace. Each generation's candidates run together
+// as the gids of one simulation, scored by trace RMSE and spike distance.
+int run_fit(const arb::context& context, const single_options& options,
+            const single_params& params, arb::profile::meter_manager& meters);
+
+// Statistics of the soma voltage over the trials of the "ensemble" section:
+// copies of the cell as gids of one simulation, each with Poisson input of
+// its own seed. Per time bin mean, variance, min and max are accumulated as
+// the samples arrive and merged over threads and ranks at the end.
+int run_ensemble(const arb::context& context, const single_options& options,
+                 const single_params& params, arb::profile::meter_manager& meters);
+
+// Spike exchange benchmark on the cells of the "network" section: spike
+// counts and exchange volume, epochs, and with profiling enabled the time
+// spent in communication, per rank.
+int run_network(const arb::context& context, const single_options& options,
+                const single_params& params, arb::profile::meter_manager& meters);
+
+// Chains or lattices of cells coupled by dendritic gap junctions, for each
+// of the sizes of the "gap" section: the time to partition and build the
+// model, and to run it, with the soma traces of the first and last cell of
+// the largest size for comparison with test_single.py.
+int run_gap(const arb::context& context, const single_options& options,
+            const single_params& params, arb::profile::meter_manager& meters);
+
+// Event delivery throughput: cells with each of the synapse counts of the
+// "synapses" section, driven by independent Poisson inputs at each of the
+// rates. Delivered events per second, and the run time split into event
+// handling and integration against a run of the same cells without input.
+int run_synapses(const arb::context& context, const single_options& options,
+                 const single_params& params, arb::profile::meter_manager& meters);
+
+// The fewest dendrite compartments whose soma trace stays within the
+// tolerance of the "discretization" section of that of the finest count,
+// by a ladder and then a bisection of candidate counts, each round of
+// candidates running together as the gids of one simulation.
+int run_discretization(const arb::context& context, const single_options& options,
+                       const single_params& params, arb::profile::meter_manager& meters);
+
+// Serve single mode jobs, one parameter json per line, from stdin or the
+// --socket UNIX socket, on one context for the lifetime of the process.
+// A result line with spikes, features and timings is written per job.
+int run_serve(const arb::context& context, const single_options& options);
+
+// Run several parameter files as independent cases, without the context of
+// the other modes: each rank runs its share of the cases either as the gids
+// of one simulation on all threads, or one case at a time on each of K
+// concurrent contexts over disjoint thread subsets, as chosen by --strategy
+// or by a short calibration run of both. One result line with spikes and
+// features is written per case.
+int run_batch(const single_options& options, unsigned num_threads, const cpu_topology& topology);
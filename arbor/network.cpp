@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "profile_regions.hpp"
+#include "reduce.hpp"
+#include "single_recipe.hpp"
+
+namespace {
+
+// Copies of the validation cell, each spike detector connected to the
+// synapse of other cells. Connections are generated per gid on demand, so
+// each rank only builds those of its own cells.
+class network_recipe: public soma_recipe {
+public:
+    network_recipe(const single_params& params):
+        soma_recipe(std::vector<single_params>(params.network.cells, params)),
+        net_(params.network),
+        weight_(params.network.weight!=0? params.network.weight: params.weight)
+    {}
+
+    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
+        if (gid<net_.stimulated) return soma_recipe::event_generators(gid);
+        return {};
+    }
+
+    std::vector<arb::cell_connection> connections_on(cell_gid_type gid) const override {
+        std::vector<arb::cell_connection> cons;
+        auto connect = [&](cell_gid_type src) {
+            cons.push_back(arb::cell_connection({src, 0}, {gid, 0}, float(weight_), float(net_.delay)));
+        };
+
+        const cell_gid_type n = net_.cells;
+        if (net_.topology=="ring") {
+            connect((gid+n-1)%n);
+        }
+        else if (net_.topology=="random") {
+            // fan_in distinct sources other than gid, seeded by gid.
+            std::seed_seq seq{net_.seed, gid};
+            std::mt19937 rng(seq);
+            std::uniform_int_distribution<cell_gid_type> pick(0, n-2);
+            std::vector<cell_gid_type> sources;
+            while (sources.size()<net_.fan_in) {
+                cell_gid_type src = pick(rng);
+                if (src>=gid) ++src;
+                if (std::find(sources.begin(), sources.end(), src)==sources.end()) sources.push_back(src);
+            }
+            for (auto src: sources) connect(src);
+        }
+        else {
+            cell_gid_type first = gid/net_.block*net_.block;
+            cell_gid_type last = std::min<cell_gid_type>(first+net_.block, n);
+            for (cell_gid_type src=first; src<last; ++src) {
+                if (src!=gid) connect(src);
+            }
+        }
+        return cons;
+    }
+
+private:
+    decltype(single_params::network) net_;
+    double weight_;
+};
+
+} // namespace
+
+int run_network(const arb::context& context, const single_options& options,
+                const single_params& params, arb::profile::meter_manager& meters)
+{
+    const bool root = arb::rank(context)==0;
+    const unsigned num_ranks = arb::num_ranks(context);
+    const auto& net = params.network;
+
+    network_recipe recipe(params);
+    auto decomp = arb::partition_load_balance(recipe, context);
+    arb::simulation sim(recipe, decomp, context);
+
+    // Both callbacks are called once per epoch, after the exchange, with the
+    // spikes of this rank and of all ranks respectively.
+    std::size_t epochs = 0, sent = 0, received = 0, max_received = 0;
+    sim.set_local_spike_callback(
+        [&](const std::vector<arb::spike>& s) {
+            ++epochs;
+            sent += s.size();
+        });
+    sim.set_global_spike_callback(
+        [&](const std::vector<arb::spike>& s) {
+            received += s.size();
+            max_received = std::max(max_received, s.size());
+        });
+
+    meters.checkpoint("model-init", context);
+
+    if (root) {
+        std::cout << "running " << net.cells << " cells, " << net.topology << " network, delay "
+                  << net.delay << " ms, on " << num_ranks << " ranks" << std::endl;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    sim.run(params.tstop, params.dt);
+    const double run_time = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+
+    meters.checkpoint("model-run", context);
+
+    // Per rank: epochs, spikes sent and received, run and communication time.
+    constexpr std::size_t nfields = 6;
+    auto all = gather({double(epochs), double(sent), double(received), double(max_received),
+                       run_time, profiled_time({"communication"})});
+
+    if (!root) return 0;
+
+    const double spike_bytes = sizeof(arb::spike);
+    nlohmann::json out;
+    out["cells"] = net.cells;
+    out["topology"] = net.topology;
+    out["delay"] = net.delay;
+    out["ranks"] = num_ranks;
+    out["threads"] = arb::num_threads(context);
+    out["spikes"] = received;
+    out["epochs"] = epochs;
+    // Arbor exchanges spikes every half of the minimum delay.
+    out["expected_epochs"] = std::ceil(params.tstop/(0.5*net.delay));
+    out["spike_bytes"] = spike_bytes;
+    auto& jranks = out["per_rank"] = nlohmann::json::array();
+
+    std::cout << "\n" << std::setw(6) << "rank" << std::setw(10) << "epochs" << std::setw(12) << "sent"
+              << std::setw(12) << "received" << std::setw(14) << "max/epoch" << std::setw(14) << "gathered(B)"
+              << std::setw(12) << "run(s)" << std::setw(12) << "comm(s)" << "\n";
+    for (std::size_t r=0; r<all.size()/nfields; ++r) {
+        const double* x = all.data()+nfields*r;
+        nlohmann::json j;
+        j["epochs"] = x[0];
+        j["spikes_sent"] = x[1];
+        j["spikes_received"] = x[2];
+        j["max_spikes_per_epoch"] = x[3];
+        j["bytes_gathered"] = x[2]*spike_bytes;
+        j["run_time"] = x[4];
+        j["communication_time"] = x[5];
+        jranks.push_back(j);
+
+        std::cout << std::setw(6) << r << std::setw(10) << x[0] << std::setw(12) << x[1]
+                  << std::setw(12) << x[2] << std::setw(14) << x[3] << std::setw(14) << x[2]*spike_bytes
+                  << std::setw(12) << x[4] << std::setw(12) << x[5] << "\n";
+    }
+#ifndef ARB_PROFILE_ENABLED
+    std::cout << "(communication time requires an Arbor build with profiling)\n";
+#endif
+
+    std::string path = options.results_file.empty()? "network.json": options.results_file;
+    std::ofstream file(path);
+    file << std::setw(1) << out << "\n";
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <arbor/common_types.hpp>
+#include <arbor/sampling.hpp>
+#include <arbor/simple_sampler.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "trace_features.hpp"
+
+// Compares samples against a reference trace as they arrive in the sampler
+// callback, keeping the running absolute and relative error as computed by
+// comparex. The reference is linearly interpolated at each sample time, and
+// the relative error is the absolute error over the largest magnitude of
+// the interpolated reference.
+//
+// The comparison fails as soon as the absolute error exceeds its tolerance,
+// or the relative error is sure to: taken over the largest magnitude of the
+// whole reference, which the interpolated values cannot exceed. The time of
+// the first violating sample is recorded so that the simulation can be
+// stopped early. Whether the relative error itself passes is only known
+// once all samples are in, and is settled by finish().
+class online_comparator {
+public:
+    online_comparator(arb::trace_data<double> reference, double abserr_tol, double relerr_tol):
+        reference_(std::move(reference)), interpolate_(reference_),
+        abserr_tol_(abserr_tol), relerr_tol_(relerr_tol)
+    {
+        if (reference_.empty()) {
+            throw std::runtime_error("Empty reference trace.");
+        }
+        for (const auto& s: reference_) {
+            ref_absmax_ = std::max(ref_absmax_, std::abs(s.v));
+        }
+    }
+
+    online_comparator(const online_comparator&) = delete;
+    online_comparator& operator=(const online_comparator&) = delete;
+
+    // Sampler function to attach to the probe under comparison.
+    // The comparator must outlive the simulation it is attached to.
+    arb::sampler_function sampler() {
+        return [this](arb::cell_member_type, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+            for (std::size_t i=0; i<n; ++i) {
+                if (auto p = arb::util::any_cast<const double*>(recs[i].data)) {
+                    compare(recs[i].time, *p);
+                }
+            }
+        };
+    }
+
+    // Settle the relative error test after the last sample; a failure is
+    // recorded at the sample of largest absolute error.
+    void finish() {
+        if (!failed_ && relerr()>relerr_tol_) {
+            failed_ = true;
+            t_fail_ = t_max_;
+            v_fail_ = v_max_;
+            ref_fail_ = ref_max_;
+        }
+    }
+
+    bool failed() const { return failed_; }
+    double abserr() const { return abserr_; }
+    double relerr() const { return sample_absmax_>0? abserr_/sample_absmax_: 0; }
+
+    // Write a compact record of the first violation as json.
+    void write_failure_record(const std::string& path, double t_stop) const {
+        nlohmann::json json;
+        json["status"] = failed_? "fail": "pass";
+        json["t_fail"] = t_fail_;
+        json["t_stop"] = t_stop;
+        json["voltage"] = v_fail_;
+        json["reference"] = ref_fail_;
+        json["abserr"] = abserr();
+        json["relerr"] = relerr();
+        json["abserr_tol"] = abserr_tol_;
+        json["relerr_tol"] = relerr_tol_;
+
+        std::ofstream file(path);
+        file << std::setw(1) << json << "\n";
+    }
+
+private:
+    arb::trace_data<double> reference_;
+    trace_interpolator interpolate_;
+    double abserr_tol_;
+    double relerr_tol_;
+    double ref_absmax_ = 0;
+    double sample_absmax_ = 0;  // Of the reference at the sample times.
+
+    double abserr_ = 0;
+    double t_max_ = std::numeric_limits<double>::quiet_NaN();
+    double v_max_ = std::numeric_limits<double>::quiet_NaN();
+    double ref_max_ = std::numeric_limits<double>::quiet_NaN();
+    bool failed_ = false;
+    double t_fail_ = std::numeric_limits<double>::quiet_NaN();
+    double v_fail_ = std::numeric_limits<double>::quiet_NaN();
+    double ref_fail_ = std::numeric_limits<double>::quiet_NaN();
+
+    void compare(double t, double v) {
+        if (failed_) return;
+
+        // Samples arrive in increasing time order.
+        double r = interpolate_(t);
+        sample_absmax_ = std::max(sample_absmax_, std::abs(r));
+        if (!(std::abs(v-r)<=abserr_)) {
+            abserr_ = std::abs(v-r);
+            t_max_ = t;
+            v_max_ = v;
+            ref_max_ = r;
+        }
+
+        if (abserr_>abserr_tol_ || (ref_absmax_>0 && abserr_/ref_absmax_>relerr_tol_)) {
+            failed_ = true;
+            t_fail_ = t;
+            v_fail_ = v;
+            ref_fail_ = r;
+        }
+    }
+};
@@ -1,15 +1,45 @@
+#pragma once
+
 #include <iostream>
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <fstream>
+#include <limits>
+#include <map>
 #include <random>
+#include <string>
+#include <vector>
 
 #include <arbor/cable_cell.hpp>
 #include <common/json_params.hpp>
+#include <common/trace_archive.hpp>
 
 std::vector<double> read_spike_times();
 
+// A quantity recorded at a location on the cell, in addition to the soma
+// voltage. Segment 0 is the soma, segment 1 the dendrite.
+struct probe_spec {
+    std::string quantity;   // One of "voltage" or "current".
+    unsigned segment = 0;
+    double position = 0.5;
+};
+
+// Input events to one synapse target of every cell: Poisson or regular at a
+// rate from start until stop. The events are generated window by window as
+// the simulation asks for them, from a seed that depends only on (seed,
+// gid, target).
+struct input_spec {
+    std::string type = "poisson";   // One of "poisson" or "regular".
+    unsigned target = 0;
+    double rate = 10;               // Hz
+    double start = 0;               // ms
+    double stop = std::numeric_limits<double>::infinity();
+    unsigned seed = 1;
+    double weight = NAN;            // The "weight" parameter if not given.
+};
+
 struct single_params {
     double temp, v_init;
     double tau1_syn, tau2_syn, e_syn;
@@ -19,34 +49,346 @@ struct single_params {
     double syn_loc;
     double dt, weight;
     bool soma_hh, dend_hh;
+    double spike_threshold = 10;
+    unsigned dend_compartments = 2000;
+
+    // Simulated time, and the interval at which a single run writes out its
+    // buffered output and reports progress (the whole run if zero).
+    double tstop = 200;
+    double chunk = 0;
+
+    // Input spike trains of the cells from a binary spike train file (see
+    // common/spike_trains.hpp), or generated inputs, in place of the fixed
+    // input events.
+    std::string input_file;
+    std::vector<input_spec> inputs;
+
+    // Run mode: "single", or one of the analysis modes below, each of which
+    // takes its settings from a section of the same name.
+    std::string mode = "single";
+
+    // Finite-difference sensitivity of trace features to cell parameters.
+    struct {
+        std::vector<std::string> params;    // Names as in the parameter file.
+        double step = 0.01;                 // Relative perturbation.
+    } sensitivity;
+
+    // Sampling of the soma voltage: every dt throughout ("regular"), or every
+    // dt in windows from pre before to post after each input event, and
+    // every sparse_dt (none if zero) elsewhere ("windowed"). A detected spike
+    // opens a window up to post after it too, but only from the end of the
+    // run interval it falls in: the next chunk, or check interval when
+    // comparing online, since the sampling of an interval is fixed when it
+    // starts. Without chunks, spikes open no windows.
+    struct {
+        std::string schedule = "regular";
+        double dt = 0.001;
+        double sparse_dt = 0;
+        double pre = 1;
+        double post = 10;
+    } sampling;
+
+    // Additional quantities sampled together on the sampling schedule.
+    std::vector<probe_spec> recording;
+
+    // Number of voltage probes evenly spaced along the dendrite, after those
+    // of the recording; set by the --dendrite option.
+    unsigned dendrite_probes = 0;
+
+    // Differential evolution fit of cell parameters to a reference trace.
+    struct {
+        std::vector<std::string> params;    // Names as in the parameter file.
+        std::vector<std::array<double, 2>> bounds;
+        unsigned population = 32;
+        unsigned generations = 50;
+        double F = 0.7;                     // Differential weight.
+        double CR = 0.9;                    // Crossover probability.
+        unsigned seed = 42;
+        double spike_weight = 1;            // Score weight of spike distance (mV/ms).
+    } fit;
+
+    // Trials of the cell driven by Poisson input instead of the fixed input
+    // events, each with its own seed, summarized by the statistics of the
+    // soma voltage in each bin of time.
+    struct {
+        unsigned trials = 64;
+        double rate = 30;                   // Input rate (Hz).
+        unsigned seed = 1;
+        double bin = 0;                     // Bin width (ms); the sampling dt if zero.
+    } ensemble;
+
+    // Copies of the cell connected soma to synapse, for benchmarks of spike
+    // exchange: a ring, a random graph with a fixed fan-in, or fully
+    // connected blocks. The first "stimulated" cells get the input events.
+    struct {
+        unsigned cells = 64;
+        std::string topology = "ring";      // One of "ring", "random" or "all-to-all".
+        double delay = 5;                   // Connection delay (ms).
+        double weight = 0;                  // Connection weight; the input weight if zero.
+        unsigned fan_in = 10;               // Incoming connections per cell ("random").
+        unsigned block = 16;                // Cells per connected block ("all-to-all").
+        unsigned stimulated = 1;
+        unsigned seed = 1;
+    } network;
+
+    // Copies of the cell coupled by gap junctions between their dendrites,
+    // as a chain, or as a lattice of rows of "width" cells, each coupled to
+    // its neighbours in the row and column; run once for each size. The
+    // first "stimulated" cells get the input events.
+    struct {
+        std::string topology = "chain";     // One of "chain" or "lattice".
+        std::vector<unsigned> sizes = {2, 4, 8, 16, 32, 64};
+        unsigned width = 8;                 // Cells per row ("lattice").
+        double ggap = 0.001;                // Junction conductance (μS).
+        double location = 1;                // Position of the junctions on the dendrite.
+        unsigned stimulated = 1;
+    } gap;
+
+    // Synapses placed along the dendrite, evenly spaced or at random, each
+    // with Poisson input of its own; run for every count and rate.
+    struct {
+        std::vector<unsigned> counts = {10, 100, 1000};
+        std::vector<double> rates = {10, 100};  // Input rate per synapse (Hz).
+        std::string placement = "uniform";      // One of "uniform" or "random".
+        unsigned cells = 1;
+        double weight = 0.001;
+        unsigned seed = 1;
+    } synapses;
+
+    // Search for the fewest dendrite compartments whose soma trace is within
+    // tolerance of that of the finest discretization: a ladder of counts
+    // from finest down to coarsest by the given ratio, then rounds of up to
+    // "parallel" counts between the coarsest passing and the finest failing
+    // count of the ladder, until they are adjacent. The counts of each round
+    // run together as the gids of one simulation.
+    struct {
+        unsigned finest = 2000;
+        unsigned coarsest = 1;
+        double ratio = 2;
+        double tolerance = 0.1;             // RMS error of the soma trace (mV).
+        unsigned parallel = 8;
+    } discretization;
 };
 
-single_params read_params(int argc, char** argv) {
-    single_params p;
+// The parameters that may differ between the cells of one simulation,
+// by name in the parameter file. Global properties and dt are excluded.
+inline double* cell_param(single_params& p, const std::string& name) {
+    static const std::map<std::string, double single_params::*> fields = {
+        {"tau1_syn", &single_params::tau1_syn},
+        {"tau2_syn", &single_params::tau2_syn},
+        {"e_syn", &single_params::e_syn},
+        {"hh_gnabar", &single_params::hh_gnabar},
+        {"hh_gkbar", &single_params::hh_gkbar},
+        {"hh_gl", &single_params::hh_gl},
+        {"hh_ena", &single_params::hh_ena},
+        {"hh_ek", &single_params::hh_ek},
+        {"pas_e", &single_params::pas_e},
+        {"pas_g", &single_params::pas_g},
+        {"syn_loc", &single_params::syn_loc},
+        {"weight", &single_params::weight},
+        {"spike_threshold", &single_params::spike_threshold}
+    };
 
-    using sup::param_from_json;
+    auto it = fields.find(name);
+    if (it==fields.end()) {
+        throw std::runtime_error("Not a per-cell parameter: "+name);
+    }
+    return &(p.*(it->second));
+}
 
-    if (argc<2) {
-        throw std::runtime_error("No input parameter file provided.");
+// Command line options: the input parameter file and the output paths.
+struct single_options {
+    std::string params_file;
+
+    // All parameter files given; more than one runs them as a batch of
+    // independent cases (see run_batch), on the given number of concurrent
+    // contexts (one per case up to the thread count if zero), as one
+    // simulation of all cases ("batched"), as one simulation per case on
+    // the concurrent contexts ("concurrent"), or whichever a calibration
+    // run finds faster ("auto").
+    std::vector<std::string> params_files;
+    unsigned contexts = 0;
+    std::string strategy = "auto";
+
+    std::string trace_file = "voltages.json";
+    std::string spike_file = "spikes.gdf";
+    std::string trace_format = "json";     // One of "json", "gorilla", "f32" or "i16".
+    std::string spike_format = "gdf";      // One of "gdf" or "binary".
+    std::size_t spike_buffer = 1<<16;      // Spikes buffered per rank before writing.
+
+    // Append the trace and spikes of the run to a trace archive instead of
+    // writing separate files; a negative run id selects the next free index.
+    std::string archive_file;
+    long long run_id = -1;
+
+    // Online comparison against a reference trace: the run is stopped at the
+    // end of the 1 ms check interval in which either tolerance is known to be
+    // exceeded, and a failure record written.
+    std::string reference_file;
+    double abserr_tol = std::numeric_limits<double>::infinity();
+    double relerr_tol = std::numeric_limits<double>::infinity();
+    std::string failure_file = "failure.json";
+
+    // Columns of the quantities listed in the "recording" parameters.
+    std::string recording_file = "recording.json";
+
+    // Voltage at dendrite_points positions along the dendrite (one per
+    // compartment if zero), written as a dendrite matrix
+    // (common/dendrite_matrix.hpp) for comparison with NEURON by dendcompare.
+    std::string dendrite_file;
+    unsigned dendrite_points = 0;
+
+    // Output of the analysis modes; each mode has its own default.
+    std::string results_file;
+
+    // Skip probing for a GPU in GPU enabled builds.
+    bool no_gpu = false;
+
+    // Placement of worker threads ("none", "cores" or "sockets") and
+    // memory policy ("default", "local" or "interleave"); see affinity.hpp.
+    std::string bind = "none";
+    std::string numa = "default";
+
+    // Serve jobs instead of running one parameter file: parameter json read
+    // line by line from stdin, or from connections to a UNIX socket, with
+    // one result line written back per job.
+    bool serve = false;
+    std::string serve_socket;
+
+    // Append the soma features of the run as one json line to this file,
+    // instead of recording the voltage trace.
+    std::string feature_file;
+};
+
+inline single_options read_options(int argc, char** argv) {
+    single_options o;
+
+    auto value_of = [&](int& i) -> std::string {
+        if (i+1>=argc) {
+            throw std::runtime_error("Missing value for option "+std::string(argv[i]));
+        }
+        return argv[++i];
+    };
+
+    for (int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        if (arg=="-o" || arg=="--trace") {
+            o.trace_file = value_of(i);
+        }
+        else if (arg=="-s" || arg=="--spikes") {
+            o.spike_file = value_of(i);
+        }
+        else if (arg=="-f" || arg=="--trace-format") {
+            o.trace_format = value_of(i);
+            if (o.trace_format!="json" && o.trace_format!="gorilla"
+                && o.trace_format!="f32" && o.trace_format!="i16")
+            {
+                throw std::runtime_error("Unknown trace format: "+o.trace_format);
+            }
+        }
+        else if (arg=="--spike-format") {
+            o.spike_format = value_of(i);
+            if (o.spike_format!="gdf" && o.spike_format!="binary") {
+                throw std::runtime_error("Unknown spike format: "+o.spike_format);
+            }
+        }
+        else if (arg=="--spike-buffer") {
+            o.spike_buffer = std::stoul(value_of(i));
+        }
+        else if (arg=="-a" || arg=="--archive") {
+            o.archive_file = value_of(i);
+        }
+        else if (arg=="--run-id") {
+            o.run_id = std::stoll(value_of(i));
+        }
+        else if (arg=="-r" || arg=="--reference") {
+            o.reference_file = value_of(i);
+        }
+        else if (arg=="--abserr") {
+            o.abserr_tol = std::stod(value_of(i));
+        }
+        else if (arg=="--relerr") {
+            o.relerr_tol = std::stod(value_of(i));
+        }
+        else if (arg=="--failure") {
+            o.failure_file = value_of(i);
+        }
+        else if (arg=="--results") {
+            o.results_file = value_of(i);
+        }
+        else if (arg=="--recording") {
+            o.recording_file = value_of(i);
+        }
+        else if (arg=="--dendrite") {
+            o.dendrite_file = value_of(i);
+        }
+        else if (arg=="--dendrite-points") {
+            o.dendrite_points = std::stoul(value_of(i));
+        }
+        else if (arg=="--no-gpu") {
+            o.no_gpu = true;
+        }
+        else if (arg=="--bind") {
+            o.bind = value_of(i);
+        }
+        else if (arg=="--numa") {
+            o.numa = value_of(i);
+        }
+        else if (arg=="--serve") {
+            o.serve = true;
+        }
+        else if (arg=="--socket") {
+            o.serve = true;
+            o.serve_socket = value_of(i);
+        }
+        else if (arg=="--features") {
+            o.feature_file = value_of(i);
+        }
+        else if (arg=="-k" || arg=="--contexts") {
+            o.contexts = std::stoul(value_of(i));
+        }
+        else if (arg=="--strategy") {
+            o.strategy = value_of(i);
+            if (o.strategy!="auto" && o.strategy!="batched" && o.strategy!="concurrent") {
+                throw std::runtime_error("Unknown batch strategy: "+o.strategy);
+            }
+        }
+        else if (arg.size()>1 && arg[0]=='-') {
+            throw std::runtime_error("Unrecognized option: "+arg);
+        }
+        else {
+            if (o.params_file.empty()) o.params_file = arg;
+            o.params_files.push_back(arg);
+        }
     }
-    if (argc>2) {
-        throw std::runtime_error("More than command line one option not permitted.");
+
+    if (o.params_files.size()>1 && o.serve) {
+        throw std::runtime_error("More than one input parameter file not permitted when serving jobs.");
     }
 
-    std::string fname = argv[1];
-    std::cout << "Loading parameters from file: " << fname << "\n";
-    std::ifstream f(fname);
+    if (o.params_file.empty() && !o.serve) {
+        throw std::runtime_error("No input parameter file provided.");
+    }
+    return o;
+}
 
-    if (!f.good()) {
-        throw std::runtime_error("Unable to open input parameter file: "+fname);
+inline void warn_unused(const nlohmann::json& json, const std::string& prefix = "") {
+    for (auto it=json.begin(); it!=json.end(); ++it) {
+        std::cout << "  Warning: unused input parameter: \"" << prefix << it.key() << "\"\n";
     }
+}
 
-    nlohmann::json json;
-    json << f;
+// Parameters from the json of a parameter file.
+inline single_params parse_params(nlohmann::json json) {
+    single_params p;
+
+    using sup::param_from_json;
 
     param_from_json(p.temp, "temp", json);
     param_from_json(p.v_init, "vinit", json);
     param_from_json(p.dt, "dt_arbor", json);
+    param_from_json(p.tstop, "tstop", json);
+    param_from_json(p.chunk, "chunk", json);
     param_from_json(p.tau1_syn, "tau1_syn", json);
     param_from_json(p.tau2_syn, "tau2_syn", json);
     param_from_json(p.e_syn, "e_syn", json);
@@ -62,12 +404,244 @@ single_params read_params(int argc, char** argv) {
     param_from_json(p.weight, "weight", json);
     param_from_json(p.soma_hh, "soma_hh", json);
     param_from_json(p.dend_hh, "dend_hh", json);
+    param_from_json(p.spike_threshold, "spike_threshold", json);
+    param_from_json(p.dend_compartments, "dend_compartments", json);
+    param_from_json(p.mode, "mode", json);
+    param_from_json(p.input_file, "input_file", json);
 
-    for (auto it=json.begin(); it!=json.end(); ++it) {
-        std::cout << "  Warning: unused input parameter: \"" << it.key() << "\"\n";
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("sensitivity", json)) {
+        auto& j = *o;
+        param_from_json(p.sensitivity.params, "params", j);
+        param_from_json(p.sensitivity.step, "step", j);
+        warn_unused(j, "sensitivity.");
+        for (auto& name: p.sensitivity.params) cell_param(p, name);
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("sampling", json)) {
+        auto& j = *o;
+        param_from_json(p.sampling.schedule, "schedule", j);
+        param_from_json(p.sampling.dt, "dt", j);
+        param_from_json(p.sampling.sparse_dt, "sparse_dt", j);
+        param_from_json(p.sampling.pre, "pre", j);
+        param_from_json(p.sampling.post, "post", j);
+        warn_unused(j, "sampling.");
+        if (p.sampling.schedule!="regular" && p.sampling.schedule!="windowed") {
+            throw std::runtime_error("Unknown sampling schedule: "+p.sampling.schedule);
+        }
+        if (!(p.sampling.dt>0)) {
+            throw std::runtime_error("sampling: dt must be positive");
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("recording", json)) {
+        for (auto& j: *o) {
+            probe_spec spec;
+            param_from_json(spec.quantity, "quantity", j);
+            std::array<double, 2> loc = {{0, 0.5}};
+            param_from_json(loc, "location", j);
+            warn_unused(j, "recording.");
+
+            if (spec.quantity!="voltage" && spec.quantity!="current") {
+                // Arbor cable cells expose only membrane voltage and total
+                // membrane current as probes.
+                throw std::runtime_error("recording: quantity \""+spec.quantity+"\" is not available as a probe");
+            }
+            if (!(loc[0]==0 || loc[0]==1) || !(loc[1]>=0 && loc[1]<=1)) {
+                throw std::runtime_error("recording: location must be [segment, position] with segment 0 or 1");
+            }
+            spec.segment = loc[0];
+            spec.position = loc[1];
+            p.recording.push_back(spec);
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("inputs", json)) {
+        for (auto& j: *o) {
+            input_spec in;
+            param_from_json(in.type, "type", j);
+            param_from_json(in.target, "target", j);
+            param_from_json(in.rate, "rate", j);
+            param_from_json(in.start, "start", j);
+            param_from_json(in.stop, "stop", j);
+            param_from_json(in.seed, "seed", j);
+            param_from_json(in.weight, "weight", j);
+            warn_unused(j, "inputs.");
+
+            if (in.type!="poisson" && in.type!="regular") {
+                throw std::runtime_error("inputs: unknown type: "+in.type);
+            }
+            if (!(in.rate>0) || !(in.start>=0) || !(in.stop>=in.start)) {
+                throw std::runtime_error("inputs: rate must be positive, and 0 <= start <= stop");
+            }
+            if (std::isnan(in.weight)) in.weight = p.weight;
+            p.inputs.push_back(in);
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("fit", json)) {
+        auto& j = *o;
+        if (auto b = sup::find_and_remove_json<nlohmann::json>("params", j)) {
+            for (auto it=b->begin(); it!=b->end(); ++it) {
+                cell_param(p, it.key());
+                std::vector<double> range = *it;
+                if (range.size()!=2 || !(range[0]<range[1])) {
+                    throw std::runtime_error("fit: bounds of "+it.key()+" must be [lower, upper]");
+                }
+                p.fit.params.push_back(it.key());
+                p.fit.bounds.push_back({range[0], range[1]});
+            }
+        }
+        param_from_json(p.fit.population, "population", j);
+        param_from_json(p.fit.generations, "generations", j);
+        param_from_json(p.fit.F, "F", j);
+        param_from_json(p.fit.CR, "CR", j);
+        param_from_json(p.fit.seed, "seed", j);
+        param_from_json(p.fit.spike_weight, "spike_weight", j);
+        warn_unused(j, "fit.");
+        if (p.fit.population<4) {
+            throw std::runtime_error("fit: population must be at least 4");
+        }
     }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("ensemble", json)) {
+        auto& j = *o;
+        param_from_json(p.ensemble.trials, "trials", j);
+        param_from_json(p.ensemble.rate, "rate", j);
+        param_from_json(p.ensemble.seed, "seed", j);
+        param_from_json(p.ensemble.bin, "bin", j);
+        warn_unused(j, "ensemble.");
+        if (p.ensemble.trials<1 || !(p.ensemble.rate>0) || p.ensemble.bin<0) {
+            throw std::runtime_error("ensemble: trials and rate must be positive, bin not negative");
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("network", json)) {
+        auto& j = *o;
+        auto& n = p.network;
+        param_from_json(n.cells, "cells", j);
+        param_from_json(n.topology, "topology", j);
+        param_from_json(n.delay, "delay", j);
+        param_from_json(n.weight, "weight", j);
+        param_from_json(n.fan_in, "fan_in", j);
+        param_from_json(n.block, "block", j);
+        param_from_json(n.stimulated, "stimulated", j);
+        param_from_json(n.seed, "seed", j);
+        warn_unused(j, "network.");
+        if (n.topology!="ring" && n.topology!="random" && n.topology!="all-to-all") {
+            throw std::runtime_error("network: unknown topology: "+n.topology);
+        }
+        if (n.cells<2 || !(n.delay>0) || n.block<1) {
+            throw std::runtime_error("network: needs at least 2 cells, a positive delay and block size");
+        }
+        if (n.topology=="random" && n.fan_in>=n.cells) {
+            throw std::runtime_error("network: fan_in must be less than the number of cells");
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("gap", json)) {
+        auto& j = *o;
+        auto& g = p.gap;
+        param_from_json(g.topology, "topology", j);
+        param_from_json(g.sizes, "sizes", j);
+        param_from_json(g.width, "width", j);
+        param_from_json(g.ggap, "ggap", j);
+        param_from_json(g.location, "location", j);
+        param_from_json(g.stimulated, "stimulated", j);
+        warn_unused(j, "gap.");
+        if (g.topology!="chain" && g.topology!="lattice") {
+            throw std::runtime_error("gap: unknown topology: "+g.topology);
+        }
+        if (g.sizes.empty() || *std::min_element(g.sizes.begin(), g.sizes.end())<1 || g.width<1) {
+            throw std::runtime_error("gap: sizes and width must be positive");
+        }
+        if (!(g.location>=0 && g.location<=1)) {
+            throw std::runtime_error("gap: location must be in [0, 1]");
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("synapses", json)) {
+        auto& j = *o;
+        auto& y = p.synapses;
+        param_from_json(y.counts, "counts", j);
+        param_from_json(y.rates, "rates", j);
+        param_from_json(y.placement, "placement", j);
+        param_from_json(y.cells, "cells", j);
+        param_from_json(y.weight, "weight", j);
+        param_from_json(y.seed, "seed", j);
+        warn_unused(j, "synapses.");
+        if (y.placement!="uniform" && y.placement!="random") {
+            throw std::runtime_error("synapses: unknown placement: "+y.placement);
+        }
+        if (y.counts.empty() || y.rates.empty() || y.cells<1) {
+            throw std::runtime_error("synapses: counts, rates and cells must not be empty");
+        }
+        for (auto r: y.rates) {
+            if (!(r>0)) throw std::runtime_error("synapses: rates must be positive");
+        }
+    }
+
+    if (auto o = sup::find_and_remove_json<nlohmann::json>("discretization", json)) {
+        auto& j = *o;
+        auto& d = p.discretization;
+        param_from_json(d.finest, "finest", j);
+        param_from_json(d.coarsest, "coarsest", j);
+        param_from_json(d.ratio, "ratio", j);
+        param_from_json(d.tolerance, "tolerance", j);
+        param_from_json(d.parallel, "parallel", j);
+        warn_unused(j, "discretization.");
+        if (d.coarsest<1 || d.coarsest>d.finest) {
+            throw std::runtime_error("discretization: need 1 <= coarsest <= finest");
+        }
+        if (!(d.ratio>1) || !(d.tolerance>=0) || d.parallel<1) {
+            throw std::runtime_error("discretization: ratio must exceed 1, tolerance be non-negative and parallel positive");
+        }
+    }
+
+    warn_unused(json);
     std::cout << "\n";
 
+    if (!p.input_file.empty() && !p.inputs.empty()) {
+        throw std::runtime_error("inputs: give either an input_file or inputs, not both");
+    }
+    if (p.dend_compartments<1) {
+        throw std::runtime_error("dend_compartments must be positive");
+    }
+    if ((!p.input_file.empty() || !p.inputs.empty()) && p.sampling.schedule=="windowed") {
+        throw std::runtime_error("sampling: the windowed schedule needs the fixed input events, not an input_file or inputs");
+    }
+
+    const std::vector<std::string> modes = {"single", "sensitivity", "fit", "ensemble", "network", "gap", "synapses", "discretization"};
+    if (std::find(modes.begin(), modes.end(), p.mode)==modes.end()) {
+        throw std::runtime_error("Unknown mode: "+p.mode);
+    }
+
     return p;
 
-}
\ No newline at end of file
+}
+
+inline single_params read_params(const std::string& fname) {
+    std::cout << "Loading parameters from file: " << fname << "\n";
+    std::ifstream f(fname);
+
+    if (!f.good()) {
+        throw std::runtime_error("Unable to open input parameter file: "+fname);
+    }
+
+    nlohmann::json json;
+    json << f;
+
+    return parse_params(std::move(json));
+}
+
+// Hash of the parameter set in a parameter file, independent of formatting
+// and key order, that identifies runs in a trace archive.
+inline std::uint64_t params_hash(const std::string& fname) {
+    std::ifstream f(fname);
+    if (!f.good()) {
+        throw std::runtime_error("Unable to open input parameter file: "+fname);
+    }
+
+    nlohmann::json json;
+    json << f;
+    return sup::fnv1a_hash(json.dump());
+}
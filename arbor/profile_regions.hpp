@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <arbor/profile/profiler.hpp>
+#include <arbor/version.hpp>
+
+// Total time on this rank (s) in the profiler regions whose names start with
+// any of the prefixes, cumulative since the profiler was initialized; NaN in
+// builds without profiling.
+inline double profiled_time(const std::vector<std::string>& prefixes) {
+#ifdef ARB_PROFILE_ENABLED
+    auto p = arb::profile::profiler_summary();
+    double t = 0;
+    for (std::size_t i=0; i<p.names.size(); ++i) {
+        for (auto& prefix: prefixes) {
+            if (p.names[i].compare(0, prefix.size(), prefix)==0) {
+                t += p.times[i];
+                break;
+            }
+        }
+    }
+    return t;
+#else
+    return NAN;
+#endif
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arbor/common_types.hpp>
+#include <arbor/sampling.hpp>
+
+#include <common/dendrite_matrix.hpp>
+#include <common/packed_trace.hpp>
+#include <nlohmann/json.hpp>
+
+#include "parameters.hpp"
+
+// Samples of the quantities of a recording spec, stored by column: one
+// shared column of sample times and one column of values per quantity.
+//
+// A single sampler function serves all the probes of the spec, attached
+// with one predicate and schedule, so Arbor delivers each probe's samples
+// of an epoch in one callback and all columns share the same sample times.
+//
+// For reduced precision output, given a time quantum, the samples are moved
+// into a packed trace on each flush, so that only the samples of one chunk
+// of the run are held at full precision.
+class column_recorder {
+public:
+    // Probes first_probe, first_probe+1, ... of gid hold the quantities of spec.
+    column_recorder(std::vector<probe_spec> spec, arb::cell_gid_type gid, arb::cell_lid_type first_probe,
+                    double time_quantum = 0):
+        spec_(std::move(spec)), gid_(gid), first_probe_(first_probe), columns_(spec_.size())
+    {
+        if (time_quantum>0) {
+            std::vector<sup::packed_trace::column> cols;
+            for (const auto& s: spec_) {
+                cols.push_back({s.quantity+"@"+std::to_string(s.segment)+":"+std::to_string(s.position),
+                                s.quantity=="voltage"? "mV": "A/m^2"});
+            }
+            packed_.reset(new sup::packed_trace(time_quantum, cols));
+        }
+    }
+
+    column_recorder(const column_recorder&) = delete;
+    column_recorder& operator=(const column_recorder&) = delete;
+
+    arb::cell_member_predicate probes() const {
+        auto gid = gid_;
+        auto first = first_probe_;
+        auto last = first_probe_+spec_.size();
+        return [=](arb::cell_member_type id) {
+            return id.gid==gid && id.index>=first && id.index<last;
+        };
+    }
+
+    // The recorder must outlive the simulation it is attached to.
+    arb::sampler_function sampler() {
+        return [this](arb::cell_member_type id, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+            auto c = id.index-first_probe_;
+            auto& col = columns_[c];
+            col.reserve(col.size()+n);
+            for (std::size_t i=0; i<n; ++i) {
+                auto p = arb::util::any_cast<const double*>(recs[i].data);
+                col.push_back(p? *p: NAN);
+            }
+            if (c==0) {
+                for (std::size_t i=0; i<n; ++i) {
+                    time_.push_back(recs[i].time);
+                }
+            }
+        };
+    }
+
+    std::size_t num_samples() const {
+        std::size_t n = time_.size();
+        for (auto& c: columns_) n = std::min(n, c.size());
+        return n;
+    }
+
+    void write_json(const std::string& path) const {
+        const std::size_t n = num_samples();
+
+        nlohmann::json json;
+        json["cell"] = std::to_string(gid_)+".0";
+        json["time"] = std::vector<double>(time_.begin(), time_.begin()+n);
+
+        auto& cols = json["columns"] = nlohmann::json::array();
+        for (std::size_t c=0; c<spec_.size(); ++c) {
+            const auto& s = spec_[c];
+            nlohmann::json col;
+            col["quantity"] = s.quantity;
+            col["units"] = s.quantity=="voltage"? "mV": "A/m^2";
+            col["location"] = {s.segment, s.position};
+            col["values"] = std::vector<double>(columns_[c].begin(), columns_[c].begin()+n);
+            cols.push_back(col);
+        }
+
+        std::ofstream file(path);
+        if (!file.good()) {
+            throw std::runtime_error("Unable to open recording output file: "+path);
+        }
+        file << std::setw(1) << json << "\n";
+    }
+
+    // Move the rows sampled by every probe into the packed trace, if any.
+    void flush() {
+        if (!packed_) return;
+
+        const std::size_t n = num_samples();
+        std::vector<double> row(columns_.size());
+        for (std::size_t i=0; i<n; ++i) {
+            for (std::size_t c=0; c<columns_.size(); ++c) row[c] = columns_[c][i];
+            packed_->append(time_[i], row.data());
+        }
+        time_.erase(time_.begin(), time_.begin()+n);
+        for (auto& c: columns_) c.erase(c.begin(), c.begin()+n);
+    }
+
+    // Write the columns at reduced precision; times are quantized to the
+    // time quantum the recorder was made with.
+    void write_packed(const std::string& path, sup::packed_type type) {
+        if (!packed_) {
+            throw std::logic_error("column recorder: no time quantum for packed output");
+        }
+        flush();
+        packed_->write(path, type);
+    }
+
+private:
+    std::vector<probe_spec> spec_;
+    arb::cell_gid_type gid_;
+    arb::cell_lid_type first_probe_;
+
+    std::vector<double> time_;
+    std::vector<std::vector<double>> columns_;
+    std::unique_ptr<sup::packed_trace> packed_;
+};
+
+// Voltage along the dendrite from probes at evenly spaced positions, written
+// to a dendrite matrix (common/dendrite_matrix.hpp) as the run goes.
+//
+// As for the column_recorder, one sampler serves all the probes. Samples
+// are buffered per probe and written out as complete rows on flush, so
+// that the buffers only hold the samples of one chunk of the run.
+class dendrite_recorder {
+public:
+    // Probes first_probe, ..., first_probe+n-1 of gid are at positions
+    // (i+0.5)/n of the dendrite, i = 0, ..., n-1.
+    dendrite_recorder(const std::string& path, unsigned n, arb::cell_gid_type gid, arb::cell_lid_type first_probe):
+        gid_(gid), first_probe_(first_probe), columns_(n),
+        writer_(path, positions(n), "mV")
+    {}
+
+    dendrite_recorder(const dendrite_recorder&) = delete;
+    dendrite_recorder& operator=(const dendrite_recorder&) = delete;
+
+    static std::vector<double> positions(unsigned n) {
+        std::vector<double> x;
+        for (unsigned i=0; i<n; ++i) x.push_back((i+0.5)/n);
+        return x;
+    }
+
+    arb::cell_member_predicate probes() const {
+        auto gid = gid_;
+        auto first = first_probe_;
+        auto last = first_probe_+columns_.size();
+        return [=](arb::cell_member_type id) {
+            return id.gid==gid && id.index>=first && id.index<last;
+        };
+    }
+
+    // The recorder must outlive the simulation it is attached to.
+    arb::sampler_function sampler() {
+        return [this](arb::cell_member_type id, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+            auto c = id.index-first_probe_;
+            auto& col = columns_[c];
+            for (std::size_t i=0; i<n; ++i) {
+                auto p = arb::util::any_cast<const double*>(recs[i].data);
+                col.push_back(p? *p: NAN);
+            }
+            if (c==0) {
+                for (std::size_t i=0; i<n; ++i) time_.push_back(recs[i].time);
+            }
+        };
+    }
+
+    // Write the rows sampled by every probe.
+    void flush() {
+        std::size_t n = time_.size();
+        for (auto& c: columns_) n = std::min(n, c.size());
+
+        std::vector<float> row(columns_.size());
+        for (std::size_t i=0; i<n; ++i) {
+            for (std::size_t c=0; c<columns_.size(); ++c) row[c] = columns_[c][i];
+            writer_.append(time_[i], row.data());
+        }
+        time_.erase(time_.begin(), time_.begin()+n);
+        for (auto& c: columns_) c.erase(c.begin(), c.begin()+n);
+    }
+
+    void close() {
+        flush();
+        writer_.close();
+    }
+
+private:
+    arb::cell_gid_type gid_;
+    arb::cell_lid_type first_probe_;
+
+    std::vector<double> time_;
+    std::vector<std::vector<float>> columns_;
+    sup::dendrite_matrix_writer writer_;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <arbor/version.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+// Reductions over all ranks, for results computed on the rank that owns a
+// cell or probe. Without MPI these are the identity.
+
+inline void global_sum(std::vector<double>& x) {
+#ifdef ARB_MPI_ENABLED
+    MPI_Allreduce(MPI_IN_PLACE, x.data(), x.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+}
+
+inline unsigned global_max(unsigned x) {
+#ifdef ARB_MPI_ENABLED
+    MPI_Allreduce(MPI_IN_PLACE, &x, 1, MPI_UNSIGNED, MPI_MAX, MPI_COMM_WORLD);
+#endif
+    return x;
+}
+
+inline bool global_any(bool x) {
+    return global_max(x)!=0;
+}
+
+// Broadcast a string from the root rank to all ranks.
+inline void broadcast(std::string& s) {
+#ifdef ARB_MPI_ENABLED
+    unsigned long n = s.size();
+    MPI_Bcast(&n, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+    s.resize(n);
+    MPI_Bcast(&s[0], n, MPI_CHAR, 0, MPI_COMM_WORLD);
+#endif
+}
+
+inline void barrier() {
+#ifdef ARB_MPI_ENABLED
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+}
+
+// The concatenation of x over all ranks in rank order, on the root rank.
+// Every rank contributes the same number of values.
+inline std::vector<double> gather(const std::vector<double>& x) {
+#ifdef ARB_MPI_ENABLED
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    std::vector<double> all(rank==0? x.size()*size: 0);
+    MPI_Gather(x.data(), x.size(), MPI_DOUBLE, all.data(), x.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    return all;
+#else
+    return x;
+#endif
+}
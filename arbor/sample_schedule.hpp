@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <arbor/common_types.hpp>
+#include <arbor/schedule.hpp>
+
+#include "parameters.hpp"
+
+// Time windows of interest, kept sorted and merged. Windows may only be
+// added between runs of a simulation, not while the schedule is queried.
+class sample_windows {
+public:
+    sample_windows(double pre, double post): pre_(pre), post_(post) {}
+
+    // Add the window [t-pre, t+post) around an event at t.
+    void add(double t) {
+        add(t-pre_, t+post_);
+    }
+
+    // Add the window [t+0, t+post) after an event at t, for events that are
+    // only known once their time has passed.
+    void add_after(double t) {
+        add(t, t+post_);
+    }
+
+    void add(double begin, double end) {
+        auto it = std::lower_bound(windows_.begin(), windows_.end(), begin,
+            [](const window& w, double t) { return w.second<t; });
+        auto last = it;
+        while (last!=windows_.end() && last->first<=end) {
+            begin = std::min(begin, last->first);
+            end = std::max(end, last->second);
+            ++last;
+        }
+        it = windows_.erase(it, last);
+        windows_.insert(it, {begin, end});
+    }
+
+    // Dense windows that intersect [t0, t1).
+    std::vector<std::pair<double, double>> overlapping(double t0, double t1) const {
+        auto it = std::upper_bound(windows_.begin(), windows_.end(), t0,
+            [](double t, const window& w) { return t<w.second; });
+        std::vector<window> result;
+        for (; it!=windows_.end() && it->first<t1; ++it) {
+            result.push_back(*it);
+        }
+        return result;
+    }
+
+private:
+    using window = std::pair<double, double>;
+    double pre_, post_;
+    std::vector<window> windows_;
+};
+
+// Schedule that samples every dense_dt inside the windows and every
+// sparse_dt elsewhere, or not at all outside windows if sparse_dt is zero.
+// Sample times lie on the grids of multiples of dense_dt and sparse_dt, so
+// that they do not depend on how a run is divided into epochs.
+class windowed_schedule {
+public:
+    windowed_schedule(std::shared_ptr<sample_windows> windows, double dense_dt, double sparse_dt):
+        windows_(std::move(windows)), dense_dt_(dense_dt), sparse_dt_(sparse_dt)
+    {}
+
+    arb::time_event_span events(arb::time_type t0, arb::time_type t1) {
+        times_.clear();
+
+        double t = t0;
+        for (auto& w: windows_->overlapping(t0, t1)) {
+            append_grid(t, std::min<double>(w.first, t1), sparse_dt_);
+            append_grid(std::max<double>(w.first, t0), std::min<double>(w.second, t1), dense_dt_);
+            t = w.second;
+        }
+        if (t<t1) append_grid(t, t1, sparse_dt_);
+
+        return {times_.data(), times_.data()+times_.size()};
+    }
+
+    void reset() {}
+
+private:
+    std::shared_ptr<sample_windows> windows_;
+    double dense_dt_;
+    double sparse_dt_;
+    std::vector<arb::time_type> times_;
+
+    void append_grid(double a, double b, double dt) {
+        if (!(dt>0) || !(a<b)) return;
+        for (double k=std::ceil(a/dt);; ++k) {
+            double x = k*dt;
+            if (x>=b) break;
+            if (x>=a) times_.push_back(x);
+        }
+    }
+};
+
+// The sampling schedule selected by the "sampling" parameters: regular, or
+// windowed around the given input events. Windows after spikes can be
+// added to the returned windows between runs.
+inline arb::schedule make_sample_schedule(
+    const single_params& params, const std::vector<double>& events,
+    std::shared_ptr<sample_windows>* windows_out = nullptr)
+{
+    const auto& s = params.sampling;
+    if (s.schedule=="regular") {
+        return arb::regular_schedule(s.dt);
+    }
+
+    auto windows = std::make_shared<sample_windows>(s.pre, s.post);
+    for (auto t: events) {
+        windows->add(t);
+    }
+    if (windows_out) *windows_out = windows;
+    return arb::schedule(windowed_schedule(windows, s.dt, s.sparse_dt));
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simple_sampler.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+#include "trace_features.hpp"
+#include "trace_io.hpp"
+
+namespace {
+
+// Features of each gid are gathered as rows of a table:
+// peak voltage, spike count, RMSE, then spike times padded with NaN.
+constexpr std::size_t num_scalar_features = 3;
+
+nlohmann::json feature_json(const double* row, std::size_t num_spikes) {
+    nlohmann::json j;
+    j["peak_voltage"] = row[0];
+    j["spike_count"] = row[1];
+    j["rmse"] = row[2];
+    auto& st = j["spike_times"];
+    st = nlohmann::json::array();
+    for (std::size_t i=0; i<num_spikes; ++i) {
+        st.push_back(row[num_scalar_features+i]);
+    }
+    return j;
+}
+
+} // namespace
+
+int run_sensitivity(const arb::context& context, const single_options& options,
+                    const single_params& params, arb::profile::meter_manager& meters)
+{
+    const bool root = arb::rank(context)==0;
+    const auto& names = params.sensitivity.params;
+    if (names.empty()) {
+        throw std::runtime_error("sensitivity: no parameters selected");
+    }
+
+    // gid 0 is the baseline; gids 2k+1 and 2k+2 have parameter k perturbed
+    // by +h and -h respectively.
+    std::vector<single_params> cells(2*names.size()+1, params);
+    std::vector<double> steps;
+    for (std::size_t k=0; k<names.size(); ++k) {
+        double x = *cell_param(cells[0], names[k]);
+        double h = params.sensitivity.step*(x!=0? std::abs(x): 1.);
+        *cell_param(cells[2*k+1], names[k]) += h;
+        *cell_param(cells[2*k+2], names[k]) -= h;
+        steps.push_back(h);
+    }
+    const std::size_t ncells = cells.size();
+
+    soma_recipe recipe(cells, input_seeding::shared);
+    auto decomp = arb::partition_load_balance(recipe, context);
+    arb::simulation sim(recipe, decomp, context);
+
+    // Sample the soma voltage of every cell, as for a single run.
+    auto sched = make_sample_schedule(params, input_event_times());
+    std::vector<arb::trace_data<double>> traces(ncells);
+    for (cell_gid_type gid=0; gid<ncells; ++gid) {
+        sim.add_sampler(arb::one_probe({gid, 0}), sched, arb::make_simple_sampler(traces[gid]));
+    }
+
+    arb::trace_data<double> reference;
+    if (!options.reference_file.empty()) {
+        reference = read_trace(options.reference_file);
+    }
+
+    meters.checkpoint("model-init", context);
+
+    if (root) {
+        std::cout << "running " << ncells << " cells for " << names.size() << " parameters" << std::endl;
+    }
+    sim.run(params.tstop, params.dt);
+
+    meters.checkpoint("model-run", context);
+
+    // Compute features on the rank that owns each cell, then gather.
+    std::vector<trace_features> features(ncells);
+    unsigned max_spikes = 0;
+    for (cell_gid_type gid=0; gid<ncells; ++gid) {
+        if (traces[gid].empty()) continue;
+        features[gid] = compute_features(traces[gid], cells[gid].spike_threshold, reference);
+        max_spikes = std::max<unsigned>(max_spikes, features[gid].spike_times.size());
+    }
+    max_spikes = global_max(max_spikes);
+
+    const std::size_t width = num_scalar_features+max_spikes;
+    std::vector<double> table(ncells*width, 0.);
+    for (cell_gid_type gid=0; gid<ncells; ++gid) {
+        if (traces[gid].empty()) continue;
+        const auto& f = features[gid];
+        double* row = table.data()+gid*width;
+        row[0] = f.peak_voltage;
+        row[1] = f.spike_times.size();
+        row[2] = f.rmse;
+        for (std::size_t i=0; i<max_spikes; ++i) {
+            row[num_scalar_features+i] = i<f.spike_times.size()? f.spike_times[i]: NAN;
+        }
+    }
+    global_sum(table);
+
+    if (!root) return 0;
+
+    // d(feature)/d(param) by central differences. Spike time derivatives are
+    // defined only for spikes present in both perturbed runs (NaN otherwise).
+    nlohmann::json out;
+    out["step"] = params.sensitivity.step;
+    out["baseline"] = feature_json(table.data(), max_spikes);
+
+    std::cout << "\n" << std::setw(16) << "parameter" << std::setw(14) << "h"
+              << std::setw(14) << "d(peak)" << std::setw(14) << "d(count)"
+              << std::setw(14) << "d(rmse)" << std::setw(14) << "d(t_spike0)" << "\n";
+
+    auto& sens = out["sensitivity"];
+    for (std::size_t k=0; k<names.size(); ++k) {
+        const double* plus = table.data()+(2*k+1)*width;
+        const double* minus = table.data()+(2*k+2)*width;
+
+        std::vector<double> d(width);
+        for (std::size_t i=0; i<width; ++i) {
+            d[i] = (plus[i]-minus[i])/(2*steps[k]);
+        }
+
+        auto j = feature_json(d.data(), max_spikes);
+        j["h"] = steps[k];
+        sens[names[k]] = j;
+
+        std::cout << std::setw(16) << names[k] << std::setw(14) << steps[k];
+        for (std::size_t i=0; i<num_scalar_features+1; ++i) {
+            std::cout << std::setw(14) << (i<width? d[i]: NAN);
+        }
+        std::cout << "\n";
+    }
+
+    std::string path = options.results_file.empty()? "sensitivity.json": options.results_file;
+    std::ofstream file(path);
+    file << std::setw(1) << out << "\n";
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/simple_sampler.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+#include "streaming_features.hpp"
+
+namespace {
+
+// Newline delimited messages over a pair of file descriptors.
+class line_channel {
+public:
+    line_channel(int in, int out): in_(in), out_(out) {}
+
+    // Read the next line, without the newline; false at end of input.
+    bool read_line(std::string& line) {
+        for (;;) {
+            auto nl = buf_.find('\n');
+            if (nl!=std::string::npos) {
+                line = buf_.substr(0, nl);
+                buf_.erase(0, nl+1);
+                return true;
+            }
+
+            char chunk[4096];
+            auto n = ::read(in_, chunk, sizeof(chunk));
+            if (n<0 && errno==EINTR) continue;
+            if (n<=0) {
+                // A last line without a newline still counts.
+                if (buf_.empty()) return false;
+                line.swap(buf_);
+                buf_.clear();
+                return true;
+            }
+            buf_.append(chunk, n);
+        }
+    }
+
+    void write_line(const std::string& line) {
+        std::string s = line+"\n";
+        const char* p = s.data();
+        std::size_t left = s.size();
+        while (left) {
+            auto n = ::write(out_, p, left);
+            if (n<0 && errno==EINTR) continue;
+            if (n<0) throw std::runtime_error("serve: unable to write result");
+            p += n;
+            left -= n;
+        }
+    }
+
+private:
+    int in_, out_;
+    std::string buf_;
+};
+
+// Listening UNIX stream socket, removed on destruction.
+class unix_listener {
+public:
+    explicit unix_listener(const std::string& path): path_(path) {
+        sockaddr_un addr;
+        if (path.size()>=sizeof(addr.sun_path)) {
+            throw std::runtime_error("serve: socket path too long: "+path);
+        }
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path.c_str());
+
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_<0) {
+            throw std::runtime_error("serve: unable to create socket");
+        }
+        ::unlink(path.c_str());
+        if (::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))<0 || ::listen(fd_, 8)<0) {
+            ::close(fd_);
+            throw std::runtime_error("serve: unable to listen on "+path);
+        }
+    }
+
+    unix_listener(const unix_listener&) = delete;
+    unix_listener& operator=(const unix_listener&) = delete;
+
+    ~unix_listener() {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+
+    int accept() {
+        for (;;) {
+            int c = ::accept(fd_, nullptr, nullptr);
+            if (c>=0) return c;
+            if (errno!=EINTR) throw std::runtime_error("serve: accept failed on "+path_);
+        }
+    }
+
+private:
+    std::string path_;
+    int fd_;
+};
+
+// Whether a job line is the request {"shutdown": true}.
+bool is_shutdown(const std::string& line) {
+    try {
+        auto j = nlohmann::json::parse(line);
+        return j.is_object() && j.count("shutdown") && j["shutdown"]==true;
+    }
+    catch (std::exception&) {
+        return false;
+    }
+}
+
+using clock_type = std::chrono::steady_clock;
+
+double seconds_since(clock_type::time_point t) {
+    return std::chrono::duration<double>(clock_type::now()-t).count();
+}
+
+// Run one job on every rank; the result is complete on the root rank.
+//
+// A job is either a parameter set, or an object with the parameter set
+// under "params", an optional "id" that is echoed in the result, and
+// "trace": true to return the sampled soma trace.
+nlohmann::json run_job(const arb::context& context, const std::string& line, unsigned long seq) {
+    const auto t_start = clock_type::now();
+    const bool root = arb::rank(context)==0;
+
+    nlohmann::json result;
+    result["id"] = seq;
+    try {
+        auto job = nlohmann::json::parse(line);
+        nlohmann::json params_json = job;
+        bool want_trace = false;
+        if (job.count("params")) {
+            if (job.count("id")) result["id"] = job["id"];
+            if (job.count("trace")) want_trace = job["trace"];
+            params_json = job["params"];
+        }
+
+        auto params = parse_params(params_json);
+        if (params.mode!="single") {
+            throw std::runtime_error("serve: only single mode jobs are supported");
+        }
+        const double t_parse = seconds_since(t_start);
+
+        auto t = clock_type::now();
+        soma_recipe recipe(params);
+        auto decomp = arb::partition_load_balance(recipe, context);
+        arb::simulation sim(recipe, decomp, context);
+
+        auto sched = make_sample_schedule(params, input_event_times());
+        feature_extractor features(recipe.event_generators(0), params.tstop, params.spike_threshold);
+        arb::trace_data<double> voltage;
+        std::vector<double> spikes;
+        if (root) {
+            sim.add_sampler(arb::one_probe({0, 0}), sched, features.sampler());
+            if (want_trace) {
+                sim.add_sampler(arb::one_probe({0, 0}), sched, arb::make_simple_sampler(voltage));
+            }
+            sim.set_global_spike_callback(
+                [&spikes](const std::vector<arb::spike>& s) {
+                    for (auto& spike: s) spikes.push_back(spike.time);
+                });
+        }
+        const double t_init = seconds_since(t);
+
+        t = clock_type::now();
+        sim.run(params.tstop, params.dt);
+        const double t_run = seconds_since(t);
+
+        result["status"] = "ok";
+        result["param_hash"] = sup::fnv1a_hash(params_json.dump());
+        result["spikes"] = spikes;
+        result["features"] = features.record();
+        if (want_trace) {
+            auto& jt = result["trace"]["time"] = nlohmann::json::array();
+            auto& jv = result["trace"]["voltage"] = nlohmann::json::array();
+            for (const auto& s: voltage) {
+                jt.push_back(s.t);
+                jv.push_back(s.v);
+            }
+        }
+        result["timing"] = {{"parse", t_parse}, {"init", t_init}, {"run", t_run}};
+    }
+    catch (std::exception& e) {
+        result["status"] = "error";
+        result["error"] = e.what();
+    }
+    result["timing"]["total"] = seconds_since(t_start);
+    return result;
+}
+
+} // namespace
+
+int run_serve(const arb::context& context, const single_options& options) {
+    const bool root = arb::rank(context)==0;
+
+    // Report a closed output as a write error rather than terminate.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Jobs are read on the root rank and broadcast; an empty message tells
+    // the other ranks to stop.
+    std::unique_ptr<unix_listener> listener;
+    std::unique_ptr<line_channel> channel;
+    int connection = -1;
+    if (root) {
+        if (options.serve_socket.empty()) {
+            channel.reset(new line_channel(0, 1));
+        }
+        else {
+            listener.reset(new unix_listener(options.serve_socket));
+            std::cerr << "serving on " << options.serve_socket << std::endl;
+        }
+    }
+
+    // Next job on root: the line, or empty at end of input or on shutdown.
+    auto next_job = [&]() -> std::string {
+        std::string line;
+        for (;;) {
+            if (!channel) {
+                connection = listener->accept();
+                channel.reset(new line_channel(connection, connection));
+            }
+            if (!channel->read_line(line)) {
+                if (!listener) return "";
+                channel.reset();
+                ::close(connection);
+                connection = -1;
+                continue;
+            }
+            if (line.find_first_not_of(" \t\r")==std::string::npos) continue;
+
+            if (is_shutdown(line)) {
+                channel->write_line("{\"status\":\"shutdown\"}");
+                return "";
+            }
+            return line;
+        }
+    };
+
+    unsigned long seq = 0;
+    for (;;) {
+        std::string line;
+        if (root) line = next_job();
+        broadcast(line);
+        if (line.empty()) break;
+
+        auto result = run_job(context, line, seq++);
+        if (root) {
+            try {
+                channel->write_line(result.dump());
+            }
+            catch (std::exception& e) {
+                // A socket client that went away only loses its results.
+                if (!listener) throw;
+                std::cerr << e.what() << std::endl;
+                channel.reset();
+                ::close(connection);
+                connection = -1;
+            }
+        }
+    }
+
+    if (connection>=0) ::close(connection);
+    return 0;
+}
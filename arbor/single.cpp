@@ -3,9 +3,12 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 
 #include <arbor/assert_macro.hpp>
 #include <arbor/common_types.hpp>
@@ -27,97 +30,32 @@
 #include <arborenv/with_mpi.hpp>
 #endif
 
+#include "affinity.hpp"
+#include "modes.hpp"
+#include "online_compare.hpp"
 #include "parameters.hpp"
-
-using arb::cell_gid_type;
-using arb::cell_lid_type;
-using arb::cell_size_type;
-using arb::cell_member_type;
-using arb::cell_kind;
-using arb::time_type;
-using arb::cell_probe_address;
-
-// Writes voltage trace as a json file.
-void write_trace_json(const arb::trace_data<double>& trace);
-
-// Generate a cell.
-arb::cable_cell single_cell(const single_params& params);
-
-class soma_recipe: public arb::recipe {
-public:
-    soma_recipe(single_params params): num_cells_(1), params_(params), event_weight_(params.weight) {}
-
-    cell_size_type num_cells() const override {
-        return num_cells_;
-    }
-
-    arb::util::unique_any get_cell_description(cell_gid_type gid) const override {
-        return single_cell(params_);
-    }
-
-    cell_kind get_cell_kind(cell_gid_type gid) const override {
-        return cell_kind::cable;
-    }
-
-    // Each cell has one spike detector (at the soma).
-    cell_size_type num_sources(cell_gid_type gid) const override {
-        return 0;
-    }
-
-    cell_size_type num_targets(cell_gid_type gid) const override {
-        return 1;
-    }
-
-    // Return one event generator on gid 0. This generates a single event that will
-    // kick start the spiking.
-    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
-        std::vector<arb::event_generator> gens;
-        arb::pse_vector svec;
-
-        std::vector<double> spikes = {
-                25.269724183039855, 29.37076391451496,
-                58.472477010286546, 93.80268485203328,
-                112.71090127018375, 142.6472406502223
-        };
-
-        for (auto s: spikes) {
-            svec.push_back({{gid, 0}, s, event_weight_});
-        }
-        gens.push_back(arb::explicit_generator(svec));
-        return gens;
-    }
-
-    // There is one probe (for measuring voltage at the soma) on the cell.
-    cell_size_type num_probes(cell_gid_type gid)  const override {
-        return 1;
-    }
-
-    arb::probe_info get_probe(cell_member_type id) const override {
-        // Get the appropriate kind for measuring voltage.
-        cell_probe_address::probe_kind kind = cell_probe_address::membrane_voltage;
-        // Measure at the soma.
-        arb::segment_location loc(0, 0.5);
-
-        return arb::probe_info{id, kind, cell_probe_address{loc, kind}};
-    }
-
-    arb::util::any get_global_properties(cell_kind k) const override {
-        arb::cable_cell_global_properties a;
-        a.temperature_K = params_.temp + 273.15;
-        a.init_membrane_potential_mV = params_.v_init;
-        return a;
-    }
-
-private:
-    cell_size_type num_cells_;
-    single_params params_;
-    float event_weight_;
-};
-
+#include "recording.hpp"
+#include "reduce.hpp"
+#include "sample_schedule.hpp"
+#include "single_recipe.hpp"
+#include "spike_writer.hpp"
+#include "startup_timer.hpp"
+#include "streaming_features.hpp"
+#include "trace_io.hpp"
 
 int main(int argc, char** argv) {
     try {
         bool root = true;
+        startup_timer startup(startup_timer::process_start());
+        startup.phase("pre-main");
+
+        auto options = read_options(argc, argv);
+        startup.phase("read-options");
+
+        // When serving jobs on stdin, stdout carries only the results.
+        if (options.serve && options.serve_socket.empty()) {
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
 
         arb::proc_allocation resources;
         if (auto nt = arbenv::get_env_num_threads()) {
@@ -126,55 +64,224 @@ int main(int argc, char** argv) {
         else {
             resources.num_threads = arbenv::thread_concurrency();
         }
+        startup.phase("thread-count");
 
 #ifdef ARB_MPI_ENABLED
         arbenv::with_mpi guard(argc, argv, false);
-        resources.gpu_id = arbenv::find_private_gpu(MPI_COMM_WORLD);
+        startup.phase("mpi-init");
+#endif
+
+        // Probing for a GPU starts the device driver, and with MPI is a
+        // collective over all ranks: CPU-only builds skip it.
+        resources.gpu_id = -1;
+#ifdef ARB_GPU_ENABLED
+        if (!options.no_gpu) {
+#ifdef ARB_MPI_ENABLED
+            resources.gpu_id = arbenv::find_private_gpu(MPI_COMM_WORLD);
+#else
+            resources.gpu_id = arbenv::default_gpu();
+#endif
+        }
+        startup.phase("gpu-probe");
+#endif
+
+        auto topology = read_topology();
+
+        // Several parameter files are run as a batch on contexts of its own.
+        if (options.params_files.size()>1) {
+            return run_batch(options, resources.num_threads, topology);
+        }
+
+        thread_binding binding(options.bind, options.numa, resources.num_threads, topology);
+        startup.phase("topology");
+
+#ifdef ARB_MPI_ENABLED
         auto context = arb::make_context(resources, MPI_COMM_WORLD);
         root = arb::rank(context) == 0;
 #else
-        resources.gpu_id = arbenv::default_gpu();
         auto context = arb::make_context(resources);
 #endif
+        binding.bind_new_threads();
+        startup.phase("make-context");
 
 #ifdef ARB_PROFILE_ENABLED
         arb::profile::profiler_initialize(context);
+        startup.phase("profiler-init");
 #endif
 
         // Print a banner with information about hardware configuration
         std::cout << "gpu:      " << (has_gpu(context)? "yes": "no") << "\n";
         std::cout << "threads:  " << num_threads(context) << "\n";
         std::cout << "mpi:      " << (has_mpi(context)? "yes": "no") << "\n";
-        std::cout << "ranks:    " << num_ranks(context) << "\n" << std::endl;
+        std::cout << "ranks:    " << num_ranks(context) << "\n";
+        std::cout << binding << std::endl;
+
+        if (options.serve) {
+            return run_serve(context, options);
+        }
 
+        // From here on, phases are timed by the meter manager; the report
+        // ends with the start-up phases before it.
         arb::profile::meter_manager meters;
         meters.start(context);
+        auto print_report = [&]() {
+            std::cout << arb::profile::make_meter_report(meters, context);
+            if (root) std::cout << startup;
+        };
 
         // Create an instance of our recipe.
-        auto params = read_params(argc, argv);
+        auto params = read_params(options.params_file);
+        meters.checkpoint("read-params", context);
+
+        if (params.mode!="single") {
+            int status = 0;
+            if (params.mode=="sensitivity") {
+                status = run_sensitivity(context, options, params, meters);
+            }
+            else if (params.mode=="fit") {
+                status = run_fit(context, options, params, meters);
+            }
+            else if (params.mode=="ensemble") {
+                status = run_ensemble(context, options, params, meters);
+            }
+            else if (params.mode=="network") {
+                status = run_network(context, options, params, meters);
+            }
+            else if (params.mode=="gap") {
+                status = run_gap(context, options, params, meters);
+            }
+            else if (params.mode=="synapses") {
+                status = run_synapses(context, options, params, meters);
+            }
+            else if (params.mode=="discretization") {
+                status = run_discretization(context, options, params, meters);
+            }
+            print_report();
+            return status;
+        }
+
+        if (!options.dendrite_file.empty()) {
+            params.dendrite_probes = options.dendrite_points? options.dendrite_points: params.dend_compartments;
+        }
         soma_recipe recipe(params);
 
         auto decomp = arb::partition_load_balance(recipe, context);
 
         // Construct the model.
         arb::simulation sim(recipe, decomp, context);
+        meters.checkpoint("model-build", context);
 
         // Set up the probe that will measure voltage in the cell.
 
         // The id of the only probe on the cell: the cell_member type points to (cell 0, probe 0)
         auto probe_id = cell_member_type{0, 0};
 
-        // The schedule for sampling is 10 samples every 1 ms.
-        auto sched = arb::regular_schedule(0.001);
+        // The schedule for sampling is 1000 samples every 1 ms, or as dense in
+        // windows around the input events, and after spikes from the next run
+        // interval on, only.
+        std::shared_ptr<sample_windows> windows;
+        auto sched = make_sample_schedule(params, input_event_times(), &windows);
 
-        // This is where the voltage samples will be stored as (time, value) pairs
+        // This is where the voltage samples will be stored as (time, value) pairs,
+        // until they are written out at the end of each chunk of the run.
         arb::trace_data<double> voltage;
-        // Now attach the sampler at probe_id, with sampling schedule sched, writing to voltage
-        sim.add_sampler(arb::one_probe(probe_id), sched, arb::make_simple_sampler(voltage));
+        std::unique_ptr<trace_json_writer> json_output;
+        // With compressed output, samples are instead encoded as they arrive and
+        // written out block by block.
+        std::ofstream trace_file;
+        std::unique_ptr<sup::gorilla_encoder> encoder;
+        // Reduced precision output is kept as float32 until the end of the
+        // run, when the range of an int16 trace is known.
+        const bool packed = options.trace_format=="f32" || options.trace_format=="i16";
+        const auto packed_type = options.trace_format=="f32"? sup::packed_type::float32: sup::packed_type::int16;
+        const double time_quantum = params.sampling.dt/16;
+        std::unique_ptr<sup::packed_trace> packed_voltage;
+
+        // When only features are wanted, they are computed as samples arrive
+        // and no trace is kept.
+        std::unique_ptr<feature_extractor> features;
+
+        // Now attach the sampler at probe_id, with sampling schedule sched, writing to voltage.
+        // Archived runs are stored uncompressed, so that they can be read in place.
+        const bool archive = !options.archive_file.empty();
+        if (!options.feature_file.empty()) {
+            if (root) {
+                features.reset(new feature_extractor(recipe.event_generators(0), params.tstop, params.spike_threshold));
+                sim.add_sampler(arb::one_probe(probe_id), sched, features->sampler());
+            }
+        }
+        else if (options.trace_format=="gorilla" && !archive) {
+            if (root) {
+                trace_file.open(options.trace_file, std::ios::binary);
+                if (!trace_file.good()) {
+                    throw std::runtime_error("Unable to open trace output file: "+options.trace_file);
+                }
+                encoder.reset(new sup::gorilla_encoder(trace_file));
+                sim.add_sampler(arb::one_probe(probe_id), sched, make_gorilla_sampler(*encoder));
+            }
+        }
+        else if (packed && !archive) {
+            if (root) {
+                packed_voltage.reset(new sup::packed_trace(time_quantum, {{"voltage", "mV"}}));
+                sim.add_sampler(arb::one_probe(probe_id), sched, make_packed_sampler(*packed_voltage));
+            }
+        }
+        else {
+            sim.add_sampler(arb::one_probe(probe_id), sched, arb::make_simple_sampler(voltage));
+            if (root && !archive) {
+                json_output.reset(new trace_json_writer(options.trace_file));
+            }
+        }
+
+        // Quantities of the recording spec are sampled into one columnar buffer,
+        // moved chunk by chunk into a packed trace for reduced precision output.
+        std::unique_ptr<column_recorder> recorder;
+        if (root && !params.recording.empty()) {
+            recorder.reset(new column_recorder(params.recording, 0, 1, packed? time_quantum: 0));
+            sim.add_sampler(recorder->probes(), sched, recorder->sampler());
+        }
+
+        // The voltage along the dendrite is written out chunk by chunk.
+        std::unique_ptr<dendrite_recorder> dendrite;
+        if (root && params.dendrite_probes) {
+            dendrite.reset(new dendrite_recorder(
+                options.dendrite_file, params.dendrite_probes, 0, 1+params.recording.size()));
+            sim.add_sampler(dendrite->probes(), sched, dendrite->sampler());
+        }
+
+        // Optionally compare against a reference trace as samples arrive.
+        std::unique_ptr<online_comparator> comparator;
+        if (!options.reference_file.empty()) {
+            comparator.reset(new online_comparator(
+                read_trace(options.reference_file), options.abserr_tol, options.relerr_tol));
+            sim.add_sampler(arb::one_probe(probe_id), sched, comparator->sampler());
+        }
 
-        // Set up recording of spikes to a vector on the root process.
+        // Each rank writes the spikes of its own cells as they are produced.
+        // Archived runs instead need all spikes gathered on the root process,
+        // alongside the local callback that collects spikes for sample
+        // windows, if any. The sampling of an interval passed to sim.run is
+        // fixed when it starts, so the windows are opened after each run
+        // returns, and apply from the next one on: the same sample times
+        // whatever the timing of the threads.
+        std::unique_ptr<spike_writer> spike_output;
         std::vector<arb::spike> recorded_spikes;
-        if (root) {
+        std::vector<double> window_spikes;
+        if (!archive) {
+            auto fmt = options.spike_format=="binary"? spike_writer::format::binary: spike_writer::format::gdf;
+            auto path = rank_path(options.spike_file, arb::rank(context), num_ranks(context));
+            spike_output.reset(new spike_writer(path, fmt, options.spike_buffer));
+        }
+        if (spike_output || windows) {
+            sim.set_local_spike_callback(
+                [&spike_output, &windows, &window_spikes](const std::vector<arb::spike>& spikes) {
+                    if (spike_output) spike_output->append(spikes);
+                    if (windows) {
+                        for (auto& s: spikes) window_spikes.push_back(s.time);
+                    }
+                });
+        }
+        if (archive && root) {
             sim.set_global_spike_callback(
                 [&recorded_spikes](const std::vector<arb::spike>& spikes) {
                     recorded_spikes.insert(recorded_spikes.end(), spikes.begin(), spikes.end());
@@ -184,36 +291,138 @@ int main(int argc, char** argv) {
         meters.checkpoint("model-init", context);
 
         std::cout << "running simulation" << std::endl;
-        // Run the simulation for 100 ms, with time steps of 0.025 ms.
-        sim.run(200, params.dt);
+        // Run the simulation to tstop in chunks, writing out the trace and
+        // spikes buffered in each. When comparing against a reference,
+        // advance in short intervals so that the run can stop at the first
+        // interval in which the error bound is exceeded: failures are only
+        // detected at the end of each check_interval [ms].
+        const double tfinal = params.tstop;
+        const double chunk = params.chunk>0? params.chunk: tfinal;
+        const double check_interval = 1;
+        double t = 0;
+        bool failed = false;
+        auto comparison_failed = [&comparator]() {
+            // Only the rank with the probed cell sees the samples.
+            return global_any(comparator && comparator->failed());
+        };
+
+        using clock = std::chrono::steady_clock;
+        const auto wall_start = clock::now();
+
+        while (t<tfinal && !failed) {
+            const double t_chunk = std::min(t+chunk, tfinal);
+            while (t<t_chunk && !failed) {
+                t = sim.run(comparator? std::min(t+check_interval, t_chunk): t_chunk, params.dt);
+                failed = comparison_failed();
+                for (auto s: window_spikes) windows->add_after(s);
+                window_spikes.clear();
+            }
+
+            if (json_output) {
+                json_output->append(voltage);
+                json_output->flush();
+                voltage.clear();
+            }
+            if (encoder) {
+                encoder->flush();
+            }
+            if (spike_output) {
+                spike_output->flush();
+            }
+            if (recorder) {
+                recorder->flush();
+            }
+            if (dendrite) {
+                dendrite->flush();
+            }
+
+            if (root) {
+                double wall = std::chrono::duration<double>(clock::now()-wall_start).count();
+                double rate = wall>0? t/wall: 0;
+                std::cout << "  t " << std::setw(10) << t << " ms  "
+                          << std::setw(10) << rate << " ms/s  ETA "
+                          << (rate>0? (tfinal-t)/rate: 0) << " s" << std::endl;
+            }
+        }
 
         meters.checkpoint("model-run", context);
 
+        if (comparator && !failed) {
+            comparator->finish();
+            failed = comparison_failed();
+        }
+        if (failed) {
+            if (root) {
+                std::cout << "\ncomparison failed at t = " << t << " ms: abserr "
+                          << comparator->abserr() << ", relerr " << comparator->relerr() << "\n";
+                comparator->write_failure_record(options.failure_file, t);
+            }
+            print_report();
+            return 1;
+        }
+
         auto ns = sim.num_spikes();
 
-        // Write spikes to file
         if (root) {
             std::cout << "\n" << ns << " spikes generated\n.";
-            std::ofstream fid("spikes.gdf");
-            if (!fid.good()) {
-                std::cerr << "Warning: unable to open file spikes.gdf for spike output\n";
+        }
+
+        // Append the run to the trace archive.
+        if (root && archive) {
+            std::vector<double> times, values;
+            times.reserve(voltage.size());
+            values.reserve(voltage.size());
+            for (const auto& sample: voltage) {
+                times.push_back(sample.t);
+                values.push_back(sample.v);
             }
-            else {
-                char linebuf[45];
-                for (auto spike: recorded_spikes) {
-                    auto n = std::snprintf(
-                        linebuf, sizeof(linebuf), "%u %.4f\n",
-                        unsigned{spike.source.gid}, float(spike.time));
-                    fid.write(linebuf, n);
-                }
+
+            std::vector<sup::archive_spike> spikes;
+            for (auto& spike: recorded_spikes) {
+                spikes.push_back({spike.source.gid, spike.time});
             }
+            std::stable_sort(spikes.begin(), spikes.end(),
+                [](const sup::archive_spike& a, const sup::archive_spike& b) { return a.time<b.time; });
+
+            auto id = sup::archive_append(options.archive_file, options.run_id,
+                params_hash(options.params_file), times, values, spikes);
+            std::cout << "\nappended run " << id << " to " << options.archive_file << "\n";
+        }
+
+        // Write out the remaining buffered spikes.
+        if (spike_output) {
+            spike_output->close();
+        }
+        if (dendrite) {
+            dendrite->close();
         }
 
-        // Write the samples to a json file.
-        if (root) write_trace_json(voltage);
+        // Write the samples to a json file, or the last block of compressed output.
+        if (features) {
+            nlohmann::json record;
+            if (options.run_id>=0) record["run_id"] = options.run_id;
+            record["param_hash"] = params_hash(options.params_file);
+            record["features"] = features->record();
+            append_record(options.feature_file, record);
+        }
+        else if (encoder) {
+            encoder->flush();
+        }
+        else if (packed_voltage) {
+            packed_voltage->write(options.trace_file, packed_type);
+        }
+        else if (json_output) {
+            json_output->close();
+        }
 
-        auto report = arb::profile::make_meter_report(meters, context);
-        std::cout << report;
+        if (recorder && packed) {
+            recorder->write_packed(options.recording_file, packed_type);
+        }
+        else if (recorder) {
+            recorder->write_json(options.recording_file);
+        }
+
+        print_report();
     }
     catch (std::exception& e) {
         std::cerr << "exception caught in ring miniapp: " << e.what() << "\n";
@@ -223,27 +432,6 @@ int main(int argc, char** argv) {
     return 0;
 }
 
-void write_trace_json(const arb::trace_data<double>& trace) {
-    std::string path = "./voltages.json";
-
-    nlohmann::json json;
-    json["name"] = "ring demo";
-    json["units"] = "mV";
-    json["cell"] = "0.0";
-    json["probe"] = "0";
-
-    auto& jt = json["data"]["time"];
-    auto& jy = json["data"]["voltage"];
-
-    for (const auto& sample: trace) {
-        jt.push_back(sample.t);
-        jy.push_back(sample.v);
-    }
-
-    std::ofstream file(path);
-    file << std::setw(1) << json << "\n";
-}
-
 arb::cable_cell single_cell(const single_params& params) {
     arb::cable_cell cell;
 
@@ -251,7 +439,7 @@ arb::cable_cell single_cell(const single_params& params) {
     auto soma = cell.add_soma(11.65968/2.0);
 
     auto dend = cell.add_cable(0, arb::section_kind::dendrite, 30.0/2.0, 30.0/2.0, 200);
-    dend->set_compartments(2000);
+    dend->set_compartments(params.dend_compartments);
 
     if (params.soma_hh) {
         auto hh = arb::mechanism_desc("hh");
@@ -295,6 +483,9 @@ arb::cable_cell single_cell(const single_params& params) {
     cell.add_synapse({params.syn_seg, params.syn_loc}, exp2syn);
     std::cout << params.syn_seg << " " << params.syn_loc << std::endl;
 
+    // Add a spike detector at the soma.
+    cell.add_detector({0, 0.5}, params.spike_threshold);
+
     return cell;
 }
 
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arbor/cable_cell.hpp>
+#include <arbor/common_types.hpp>
+#include <arbor/event_generator.hpp>
+#include <arbor/recipe.hpp>
+
+#include "input_generators.hpp"
+#include "parameters.hpp"
+
+using arb::cell_gid_type;
+using arb::cell_lid_type;
+using arb::cell_size_type;
+using arb::cell_member_type;
+using arb::cell_kind;
+using arb::time_type;
+using arb::cell_probe_address;
+
+// Generate a cell.
+arb::cable_cell single_cell(const single_params& params);
+
+// Times of the input events delivered to the synapse of every cell.
+inline std::vector<double> input_event_times() {
+    return {
+        25.269724183039855, 29.37076391451496,
+        58.472477010286546, 93.80268485203328,
+        112.71090127018375, 142.6472406502223
+    };
+}
+
+// Where the generated inputs of each gid come from: seeded by the gid itself,
+// for cells that stand for distinct cells of a population (network,
+// synapses), or as if the gid were gid 0, for variants of one cell that are
+// compared with each other (sensitivity, fit, discretization, batch).
+enum class input_seeding { per_gid, shared };
+
+// One or more copies of the validation cell, each gid with its own parameters.
+// Parameters that set global properties (temp, vinit), and the input file, are
+// taken from gid 0.
+class soma_recipe: public arb::recipe {
+public:
+    soma_recipe(single_params params): soma_recipe(std::vector<single_params>{params}) {}
+    soma_recipe(std::vector<single_params> params, input_seeding seeding = input_seeding::per_gid):
+        params_(std::move(params)), seeding_(seeding)
+    {
+        // An input file is mapped once, and shared by the generators of all cells.
+        if (!params_.front().input_file.empty()) {
+            trains_ = std::make_shared<const sup::mapped_spike_trains>(params_.front().input_file);
+        }
+    }
+
+    cell_size_type num_cells() const override {
+        return params_.size();
+    }
+
+    arb::util::unique_any get_cell_description(cell_gid_type gid) const override {
+        return single_cell(params_[gid]);
+    }
+
+    cell_kind get_cell_kind(cell_gid_type gid) const override {
+        return cell_kind::cable;
+    }
+
+    // Each cell has one spike detector (at the soma).
+    cell_size_type num_sources(cell_gid_type gid) const override {
+        return 1;
+    }
+
+    cell_size_type num_targets(cell_gid_type gid) const override {
+        return 1;
+    }
+
+    // Return one event generator on gid 0. This generates a single event that will
+    // kick start the spiking.
+    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
+        std::vector<arb::event_generator> gens;
+        arb::pse_vector svec;
+
+        // Ensemble trials get Poisson input instead, seeded by gid.
+        if (params_[gid].mode=="ensemble") {
+            const auto& e = params_[gid].ensemble;
+            std::seed_seq seq{e.seed, gid};
+            std::mt19937_64 rng(seq);
+            gens.push_back(arb::poisson_generator({gid, 0}, float(params_[gid].weight), 0., e.rate/1000, rng));
+            return gens;
+        }
+
+        // Trains from the input file, read window by window; with shared
+        // inputs, every gid gets the trains of gid 0.
+        if (trains_) {
+            for (auto& train: trains_->trains_of(input_gid(gid))) {
+                if (train.target>=num_targets(gid)) {
+                    throw std::runtime_error("spike trains: no target "+std::to_string(train.target)
+                        +" on gid "+std::to_string(gid)+" in "+trains_->path());
+                }
+                gens.push_back(mapped_train_generator(
+                    {gid, train.target}, float(params_[gid].weight), trains_, train));
+            }
+            return gens;
+        }
+
+        // Generated inputs.
+        if (!params_[gid].inputs.empty()) {
+            for (auto& in: params_[gid].inputs) {
+                if (in.target>=num_targets(gid)) {
+                    throw std::runtime_error("inputs: no target "+std::to_string(in.target)+" on gid "+std::to_string(gid));
+                }
+                gens.push_back(make_input_generator(in, gid, input_gid(gid)));
+            }
+            return gens;
+        }
+
+        for (auto s: input_event_times()) {
+            svec.push_back({{gid, 0}, s, float(params_[gid].weight)});
+        }
+        gens.push_back(arb::explicit_generator(svec));
+        return gens;
+    }
+
+    // Probe 0 measures voltage at the soma; probes 1, 2, ... are the
+    // quantities of the recording spec, in order, followed by the voltage
+    // probes along the dendrite.
+    cell_size_type num_probes(cell_gid_type gid)  const override {
+        return 1+params_[gid].recording.size()+params_[gid].dendrite_probes;
+    }
+
+    arb::probe_info get_probe(cell_member_type id) const override {
+        // Get the appropriate kind for measuring voltage.
+        cell_probe_address::probe_kind kind = cell_probe_address::membrane_voltage;
+        // Measure at the soma.
+        arb::segment_location loc(0, 0.5);
+
+        const auto& p = params_[id.gid];
+        if (id.index>p.recording.size()) {
+            auto i = id.index-1-p.recording.size();
+            loc = arb::segment_location(1, (i+0.5)/p.dendrite_probes);
+        }
+        else if (id.index>0) {
+            const auto& spec = p.recording[id.index-1];
+            if (spec.quantity=="current") kind = cell_probe_address::membrane_current;
+            loc = arb::segment_location(spec.segment, spec.position);
+        }
+
+        return arb::probe_info{id, kind, cell_probe_address{loc, kind}};
+    }
+
+    arb::util::any get_global_properties(cell_kind k) const override {
+        arb::cable_cell_global_properties a;
+        a.temperature_K = params_.front().temp + 273.15;
+        a.init_membrane_potential_mV = params_.front().v_init;
+        return a;
+    }
+
+    // The gid whose inputs gid receives.
+    cell_gid_type input_gid(cell_gid_type gid) const {
+        return seeding_==input_seeding::shared? 0: gid;
+    }
+
+private:
+    std::vector<single_params> params_;
+    input_seeding seeding_;
+    std::shared_ptr<const sup::mapped_spike_trains> trains_;
+};
+
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arbor/spike.hpp>
+
+// Binary spike record: source gid and detector index, and spike time.
+struct spike_record {
+    std::uint32_t gid;
+    std::uint32_t index;
+    double time;
+};
+
+// Writes spikes to a file as they are produced, from a local spike callback.
+//
+// Spikes are collected in a bounded buffer; when it is full it is swapped
+// with a second buffer that a background thread writes out, so that the
+// simulation only waits on I/O if the writer falls more than one buffer
+// behind. Memory use is bounded by twice the buffer capacity.
+class spike_writer {
+public:
+    enum class format { gdf, binary };
+
+    spike_writer(const std::string& path, format fmt, std::size_t capacity = 1<<16):
+        fmt_(fmt), capacity_(capacity? capacity: 1)
+    {
+        out_.open(path, fmt==format::binary? std::ios::binary: std::ios::out);
+        if (!out_.good()) {
+            throw std::runtime_error("Unable to open file "+path+" for spike output");
+        }
+        front_.reserve(capacity_);
+        back_.reserve(capacity_);
+        writer_ = std::thread([this]() { run(); });
+    }
+
+    spike_writer(const spike_writer&) = delete;
+    spike_writer& operator=(const spike_writer&) = delete;
+
+    ~spike_writer() { close(); }
+
+    void append(const std::vector<arb::spike>& spikes) {
+        for (auto& s: spikes) {
+            front_.push_back(s);
+            if (front_.size()==capacity_) submit();
+        }
+    }
+
+    // Hand buffered spikes to the writer thread without waiting for them to
+    // be written.
+    void flush() {
+        if (!front_.empty()) submit();
+    }
+
+    // Write out buffered spikes and stop the writer thread.
+    void close() {
+        if (!writer_.joinable()) return;
+        if (!front_.empty()) submit();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+        out_.close();
+    }
+
+    std::size_t num_written() const { return num_written_; }
+
+private:
+    std::ofstream out_;
+    format fmt_;
+    std::size_t capacity_;
+    std::size_t num_written_ = 0;
+
+    std::vector<arb::spike> front_;   // Filled by the spike callback.
+    std::vector<arb::spike> back_;    // Written by the writer thread.
+    bool pending_ = false;            // Whether back_ holds unwritten spikes.
+    bool done_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread writer_;
+
+    // Hand the front buffer to the writer thread, once it has finished with
+    // the previous one.
+    void submit() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !pending_; });
+        std::swap(front_, back_);
+        pending_ = true;
+        lock.unlock();
+        cv_.notify_all();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, [this]() { return pending_ || done_; });
+            if (!pending_) break;
+
+            lock.unlock();
+            write(back_);
+            back_.clear();
+            lock.lock();
+
+            pending_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    void write(const std::vector<arb::spike>& spikes) {
+        if (fmt_==format::binary) {
+            std::vector<spike_record> recs;
+            recs.reserve(spikes.size());
+            for (auto& s: spikes) {
+                recs.push_back({s.source.gid, s.source.index, s.time});
+            }
+            out_.write(reinterpret_cast<const char*>(recs.data()), recs.size()*sizeof(spike_record));
+        }
+        else {
+            char linebuf[45];
+            for (auto& s: spikes) {
+                auto n = std::snprintf(
+                    linebuf, sizeof(linebuf), "%u %.4f\n",
+                    unsigned{s.source.gid}, float(s.time));
+                out_.write(linebuf, n);
+            }
+        }
+        num_written_ += spikes.size();
+    }
+};
+
+// Per-rank output path: with more than one rank, the rank is inserted
+// before the extension, e.g. spikes.gdf becomes spikes.3.gdf.
+inline std::string rank_path(const std::string& path, unsigned rank, unsigned num_ranks) {
+    if (num_ranks<2) return path;
+
+    auto slash = path.find_last_of('/');
+    auto dot = path.find_last_of('.');
+    if (dot==std::string::npos || (slash!=std::string::npos && dot<slash)) {
+        return path+"."+std::to_string(rank);
+    }
+    return path.substr(0, dot)+"."+std::to_string(rank)+path.substr(dot);
+}
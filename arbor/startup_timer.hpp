@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+// Wall-clock times of the start-up phases of a process, from its start
+// until the meter manager takes over.
+//
+// The meter manager can only be started once a context exists, so the
+// phases before it (option parsing, GPU probing, context creation) are
+// timed separately and printed alongside the meter report.
+class startup_timer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit startup_timer(clock::time_point entry): last_(entry) {}
+
+    // When the process started, from its start time in /proc/self/stat in
+    // clock ticks since boot, so to within a tick (usually 10 ms). Now if
+    // that is not available.
+    static clock::time_point process_start() {
+        auto now = clock::now();
+        std::ifstream f("/proc/self/stat");
+        std::string stat;
+        std::getline(f, stat);
+
+        // The command name in field 2 may hold spaces, but not the last ')';
+        // the start time is field 22.
+        auto paren = stat.rfind(')');
+        if (paren==std::string::npos) return now;
+        std::istringstream fields(stat.substr(paren+1));
+        std::string field;
+        for (int i=3; i<22 && fields>>field; ++i) {}
+        unsigned long long ticks;
+        struct timespec boot;
+        long hz = ::sysconf(_SC_CLK_TCK);
+        if (!(fields>>ticks) || hz<=0 || ::clock_gettime(CLOCK_BOOTTIME, &boot)) return now;
+
+        double age = boot.tv_sec+1e-9*boot.tv_nsec-double(ticks)/hz;
+        if (!(age>=0)) return now;
+        return now-std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(age));
+    }
+
+    // Record the time since the previous phase ended as the named phase.
+    void phase(std::string name) {
+        auto now = clock::now();
+        phases_.emplace_back(std::move(name), std::chrono::duration<double>(now-last_).count());
+        last_ = now;
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const startup_timer& s) {
+        double total = 0;
+        o << "---- startup ----\n";
+        o << std::setw(21) << std::left << "phase" << std::right << std::setw(10) << "time (s)" << "\n";
+        for (const auto& p: s.phases_) {
+            total += p.second;
+            o << std::setw(21) << std::left << p.first << std::right
+              << std::setw(10) << std::fixed << std::setprecision(6) << p.second << "\n";
+        }
+        o << std::setw(21) << std::left << "total" << std::right
+          << std::setw(10) << total << std::defaultfloat << "\n";
+        return o;
+    }
+
+private:
+    clock::time_point last_;
+    std::vector<std::pair<std::string, double>> phases_;
+};
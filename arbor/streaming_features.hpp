@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <arbor/common_types.hpp>
+#include <arbor/event_generator.hpp>
+#include <arbor/sampling.hpp>
+
+#include <nlohmann/json.hpp>
+
+// Electrophysiology features of a soma voltage trace, computed incrementally
+// as samples arrive so that the trace itself need not be kept.
+//
+// Apart from the per-spike and per-input results, the state is a fixed size:
+//
+//   * resting potential: mean voltage before the first input event;
+//   * spikes: upward threshold crossings, interpolated between samples;
+//   * AP peak: maximum voltage while above threshold;
+//   * half-width: time between the upward and downward crossings of the
+//     level half way between rest and peak. The peak is only known after the
+//     upstroke, so the time of the latest upward crossing of every level on a
+//     fixed 1 mV grid is kept, and the upward half crossing interpolated
+//     from it once the peak is known;
+//   * AHP depth: rest minus the minimum voltage between the end of a spike
+//     and the start of the next;
+//   * EPSP amplitude: maximum rise above the voltage at each input event,
+//     within a window that ends at the next input; NaN if the window
+//     contains a spike.
+//
+// The input events are given as a list, or as the event generators of the
+// cell, which are asked for the events of one EPSP window after another as
+// the samples arrive, so that only the inputs just ahead of the latest
+// sample are held.
+class feature_extractor {
+public:
+    feature_extractor(std::vector<double> input_times, double threshold, double epsp_window = 10):
+        threshold_(threshold), epsp_window_(epsp_window), known_until_(INFINITY)
+    {
+        std::sort(input_times.begin(), input_times.end());
+        inputs_.assign(input_times.begin(), input_times.end());
+        rest_end_ = inputs_.empty()? INFINITY: inputs_.front();
+        up_time_.fill(NAN);
+    }
+
+    // Inputs from the generators, up to tstop.
+    feature_extractor(std::vector<arb::event_generator> generators, double tstop, double threshold, double epsp_window = 10):
+        generators_(std::move(generators)), threshold_(threshold), epsp_window_(epsp_window), tstop_(tstop)
+    {
+        while (inputs_.empty() && known_until_<tstop_) fetch();
+        rest_end_ = inputs_.empty()? INFINITY: inputs_.front();
+        up_time_.fill(NAN);
+    }
+
+    feature_extractor(const feature_extractor&) = delete;
+    feature_extractor& operator=(const feature_extractor&) = delete;
+
+    // Sampler function to attach to a voltage probe.
+    // The extractor must outlive the simulation it is attached to.
+    arb::sampler_function sampler() {
+        return [this](arb::cell_member_type, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+            for (std::size_t i=0; i<n; ++i) {
+                if (auto p = arb::util::any_cast<const double*>(recs[i].data)) {
+                    append(recs[i].time, *p);
+                }
+            }
+        };
+    }
+
+    // Samples must be appended in increasing time order.
+    void append(double t, double v) {
+        if (num_samples_++==0) {
+            prev_t_ = t;
+            prev_v_ = v;
+        }
+        peak_ = std::max(peak_, v);
+
+        if (t<rest_end_ && spikes_.empty()) {
+            rest_sum_ += v;
+            ++rest_count_;
+        }
+
+        update_epsp(t, v);
+        update_levels(t, v);
+        update_spikes(t, v);
+
+        prev_t_ = t;
+        prev_v_ = v;
+    }
+
+    double rest_potential() const {
+        return rest_count_? rest_sum_/rest_count_: NAN;
+    }
+
+    std::size_t num_spikes() const { return spikes_.size(); }
+
+    // Close the open EPSP window and return all features as json.
+    nlohmann::json record() {
+        close_epsp();
+
+        const double rest = rest_potential();
+        nlohmann::json j;
+        j["samples"] = num_samples_;
+        j["rest_potential"] = rest;
+        j["peak_voltage"] = num_samples_? peak_: NAN;
+        j["spike_count"] = spikes_.size();
+
+        auto& times = j["spike_times"] = nlohmann::json::array();
+        auto& peaks = j["ap_peak"] = nlohmann::json::array();
+        auto& widths = j["half_width"] = nlohmann::json::array();
+        auto& ahp = j["ahp_depth"] = nlohmann::json::array();
+        for (auto& s: spikes_) {
+            times.push_back(s.time);
+            peaks.push_back(s.peak);
+            widths.push_back(s.half_width);
+            ahp.push_back(rest-s.trough);
+        }
+        j["epsp_amplitude"] = epsp_amplitude_;
+        return j;
+    }
+
+private:
+    struct spike_features {
+        double time;
+        double peak;
+        double half_width = NAN;
+        double trough = NAN;
+    };
+
+    static constexpr double level_min = -120;   // mV
+    static constexpr std::size_t num_levels = 201;
+
+    // Inputs not yet reached, all those before known_until_; those from
+    // known_until_ to tstop_ are still to be asked of the generators.
+    std::vector<arb::event_generator> generators_;
+    std::deque<double> inputs_;
+    double threshold_;
+    double epsp_window_;
+    double known_until_ = 0;
+    double tstop_ = INFINITY;
+    double rest_end_;
+
+    std::size_t num_samples_ = 0;
+    double prev_t_ = 0, prev_v_ = 0;
+    double peak_ = -INFINITY;
+
+    double rest_sum_ = 0;
+    std::size_t rest_count_ = 0;
+
+    std::vector<spike_features> spikes_;
+    bool above_ = false;            // Above threshold in the current spike.
+    bool awaiting_half_ = false;    // Downward half crossing not yet seen.
+    std::array<double, num_levels> up_time_;
+
+    bool epsp_open_ = false;
+    double epsp_end_ = 0, epsp_base_ = 0, epsp_max_ = 0;
+    bool epsp_spiked_ = false;
+    std::vector<double> epsp_amplitude_;
+
+    void close_epsp() {
+        if (!epsp_open_) return;
+        epsp_amplitude_.push_back(epsp_spiked_? NAN: epsp_max_-epsp_base_);
+        epsp_open_ = false;
+    }
+
+    // Ask the generators for the inputs of the next window.
+    void fetch() {
+        const double t1 = std::min(known_until_+epsp_window_, tstop_);
+        std::vector<double> times;
+        for (auto& g: generators_) {
+            auto seq = g.events(known_until_, t1);
+            for (auto e = seq.first; e!=seq.second; ++e) times.push_back(e->time);
+        }
+        std::sort(times.begin(), times.end());
+        inputs_.insert(inputs_.end(), times.begin(), times.end());
+        known_until_ = t1;
+    }
+
+    // Make sure all inputs at or before t are known.
+    void fetch_through(double t) {
+        while (known_until_<=t && known_until_<tstop_) fetch();
+    }
+
+    void update_epsp(double t, double v) {
+        if (epsp_open_ && t>=epsp_end_) close_epsp();
+
+        fetch_through(t);
+        while (!inputs_.empty() && inputs_.front()<=t) {
+            close_epsp();
+            double end = inputs_.front()+epsp_window_;
+            inputs_.pop_front();
+            fetch_through(end);
+            if (!inputs_.empty()) end = std::min(end, inputs_.front());
+
+            epsp_open_ = true;
+            epsp_end_ = end;
+            epsp_base_ = epsp_max_ = v;
+            epsp_spiked_ = false;
+        }
+        if (epsp_open_) epsp_max_ = std::max(epsp_max_, v);
+    }
+
+    // Record the times at which a rising segment crosses each grid level.
+    void update_levels(double t, double v) {
+        if (!(v>prev_v_)) return;
+        double lo = std::max(std::floor(prev_v_-level_min)+1, 0.);
+        double hi = std::min(std::floor(v-level_min), double(num_levels-1));
+        for (double i=lo; i<=hi; ++i) {
+            double level = level_min+i;
+            up_time_[std::size_t(i)] = prev_t_ + (t-prev_t_)*(level-prev_v_)/(v-prev_v_);
+        }
+    }
+
+    // Time of the latest upward crossing of level, interpolated on the grid.
+    double up_time(double level) const {
+        double x = level-level_min;
+        if (!(x>=0) || x>=num_levels-1) return NAN;
+        std::size_t i = x;
+        double f = x-i;
+        return up_time_[i] + (up_time_[i+1]-up_time_[i])*f;
+    }
+
+    void update_spikes(double t, double v) {
+        if (prev_v_<threshold_ && v>=threshold_) {
+            double ts = prev_t_ + (t-prev_t_)*(threshold_-prev_v_)/(v-prev_v_);
+            spikes_.push_back({ts, v});
+            above_ = true;
+            awaiting_half_ = true;
+            if (epsp_open_) epsp_spiked_ = true;
+        }
+        if (spikes_.empty()) return;
+
+        auto& s = spikes_.back();
+        if (above_) {
+            s.peak = std::max(s.peak, v);
+            if (v<threshold_) {
+                above_ = false;
+                s.trough = v;
+            }
+        }
+        else {
+            s.trough = std::min(s.trough, v);
+        }
+
+        if (awaiting_half_ && v<prev_v_) {
+            double half = 0.5*(rest_potential()+s.peak);
+            if (prev_v_>=half && v<half) {
+                double t_down = prev_t_ + (t-prev_t_)*(half-prev_v_)/(v-prev_v_);
+                s.half_width = t_down-up_time(half);
+                awaiting_half_ = false;
+            }
+        }
+    }
+};
+
+// Append one line to a file with a single write, so that runs of a sweep
+// can share one record file.
+inline void append_record(const std::string& path, const nlohmann::json& record) {
+    std::string line = record.dump()+"\n";
+
+    int fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND, 0666);
+    if (fd<0) {
+        throw std::runtime_error("Unable to open record file: "+path);
+    }
+    auto n = ::write(fd, line.data(), line.size());
+    ::close(fd);
+    if (n!=ssize_t(line.size())) {
+        throw std::runtime_error("Unable to write record to "+path);
+    }
+}
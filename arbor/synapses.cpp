@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/simulation.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include "input_generators.hpp"
+#include "modes.hpp"
+#include "parameters.hpp"
+#include "profile_regions.hpp"
+#include "reduce.hpp"
+#include "single_recipe.hpp"
+
+namespace {
+
+// Copies of the validation cell with extra exp2syn synapses on the
+// dendrite, targets 1 to N, each with Poisson input at the given rate
+// (none if zero), seeded by (seed, gid, target). Target 0, the synapse of
+// the validation cell, gets no input.
+class synapse_recipe: public soma_recipe {
+public:
+    synapse_recipe(const single_params& params, unsigned nsyn, double rate, counting_generator::counter count):
+        soma_recipe(std::vector<single_params>(params.synapses.cells, params)),
+        params_(params), rate_(rate), count_(std::move(count))
+    {
+        const auto& y = params.synapses;
+        std::mt19937 rng(y.seed);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        for (unsigned i=0; i<nsyn; ++i) {
+            locations_.push_back(y.placement=="uniform"? (i+0.5)/nsyn: uniform(rng));
+        }
+    }
+
+    arb::util::unique_any get_cell_description(cell_gid_type gid) const override {
+        auto cell = single_cell(params_);
+        auto exp2syn = arb::mechanism_desc("exp2syn");
+        exp2syn.set("tau1", params_.tau1_syn);
+        exp2syn.set("tau2", params_.tau2_syn);
+        exp2syn.set("e", params_.e_syn);
+        for (auto x: locations_) {
+            cell.add_synapse({1, x}, exp2syn);
+        }
+        return arb::util::unique_any(std::move(cell));
+    }
+
+    cell_size_type num_targets(cell_gid_type gid) const override {
+        return 1+locations_.size();
+    }
+
+    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
+        std::vector<arb::event_generator> gens;
+        if (rate_<=0) return gens;
+
+        const float weight = params_.synapses.weight;
+        for (cell_lid_type target=1; target<=locations_.size(); ++target) {
+            std::seed_seq seq{params_.synapses.seed, gid, target};
+            std::mt19937_64 rng(seq);
+            gens.push_back(counting_generator(
+                arb::poisson_generator({gid, target}, weight, 0., rate_/1000, rng), count_));
+        }
+        return gens;
+    }
+
+private:
+    single_params params_;
+    double rate_;
+    counting_generator::counter count_;
+    std::vector<double> locations_;
+};
+
+// Profiler regions of event setup and delivery, and of the rest of the
+// integration step.
+const std::vector<std::string> event_regions = {
+    "advance_eventsetup", "advance_integrate_events", "communication_enqueue"};
+const std::vector<std::string> integration_regions = {
+    "advance_integrate_current", "advance_integrate_matrix", "advance_integrate_state",
+    "advance_integrate_ionupdate", "advance_integrate_threshold", "advance_integrate_post"};
+
+} // namespace
+
+int run_synapses(const arb::context& context, const single_options& options,
+                 const single_params& params, arb::profile::meter_manager& meters)
+{
+    const bool root = arb::rank(context)==0;
+    const unsigned nranks = arb::num_ranks(context);
+    const auto& y = params.synapses;
+
+    nlohmann::json out;
+    out["cells"] = y.cells;
+    out["placement"] = y.placement;
+    out["weight"] = y.weight;
+    auto& jruns = out["runs"] = nlohmann::json::array();
+
+    if (root) {
+        std::cout << std::setw(10) << "synapses" << std::setw(10) << "rate(Hz)" << std::setw(12) << "events"
+                  << std::setw(12) << "run(s)" << std::setw(14) << "events/s" << std::setw(12) << "events(s)"
+                  << std::setw(12) << "integ(s)" << std::setw(14) << "prof ev(s)" << std::setw(14) << "prof int(s)" << "\n";
+    }
+
+    // Times are the means over ranks; event counts the sums.
+    auto run = [&](unsigned nsyn, double rate) {
+        auto count = std::make_shared<std::atomic<std::uint64_t>>(0);
+        synapse_recipe recipe(params, nsyn, rate, count);
+        auto decomp = arb::partition_load_balance(recipe, context);
+        arb::simulation sim(recipe, decomp, context);
+
+        const double ev0 = profiled_time(event_regions);
+        const double in0 = profiled_time(integration_regions);
+        auto t0 = std::chrono::steady_clock::now();
+        sim.run(params.tstop, params.dt);
+        std::vector<double> r = {
+            std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count(),
+            double(count->load()),
+            profiled_time(event_regions)-ev0,
+            profiled_time(integration_regions)-in0};
+        global_sum(r);
+        r[0] /= nranks;
+        r[2] /= nranks;
+        r[3] /= nranks;
+        return r;
+    };
+
+    for (auto nsyn: y.counts) {
+        // The same cells without input: integration alone.
+        const double baseline = run(nsyn, 0)[0];
+        meters.checkpoint("baseline-"+std::to_string(nsyn), context);
+
+        for (auto rate: y.rates) {
+            auto r = run(nsyn, rate);
+            meters.checkpoint("run-"+std::to_string(nsyn)+"-"+std::to_string(int(rate)), context);
+            if (!root) continue;
+
+            nlohmann::json j;
+            j["synapses"] = nsyn;
+            j["rate"] = rate;
+            j["events"] = r[1];
+            j["run_time"] = r[0];
+            j["events_per_second"] = r[1]/r[0];
+            j["event_time"] = r[0]-baseline;
+            j["integration_time"] = baseline;
+            j["profiled_event_time"] = r[2];
+            j["profiled_integration_time"] = r[3];
+            jruns.push_back(j);
+
+            std::cout << std::setw(10) << nsyn << std::setw(10) << rate << std::setw(12) << r[1]
+                      << std::setw(12) << r[0] << std::setw(14) << r[1]/r[0] << std::setw(12) << r[0]-baseline
+                      << std::setw(12) << baseline << std::setw(14) << r[2] << std::setw(14) << r[3] << std::endl;
+        }
+    }
+
+    if (!root) return 0;
+#ifndef ARB_PROFILE_ENABLED
+    std::cout << "(profiled times require an Arbor build with profiling)\n";
+#endif
+
+    std::string path = options.results_file.empty()? "synapses.json": options.results_file;
+    std::ofstream file(path);
+    file << std::setw(1) << out << "\n";
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * Native implementation of thresholdx: simple predicates over NetCDF data.
+ *
+ * Datasets are memory mapped, all predicates on a variable are evaluated
+ * in one pass over its data, and files are processed in parallel.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common/netcdf_classic.hpp>
+
+const char* usage_str =
+    "usage: thresholdx-native [-h] -e EXPR [-e EXPR ...] [-q] [-j N] FILE [FILE ...]\n";
+
+const char* help_str =
+    "\n"
+    "Perform simple predicates over netcdf data.\n"
+    "\n"
+    "positional arguments:\n"
+    "  FILE       NetCDF dataset (classic format)\n"
+    "\n"
+    "optional arguments:\n"
+    "  -h, --help show this help message and exit\n"
+    "  -e EXPR    predicate\n"
+    "  -q         suppress test output\n"
+    "  -j N       number of files to process concurrently\n"
+    "\n"
+    "For each supplied expression, test if the predicate is satisfied\n"
+    "by each element of the variable in each NetCDF file FILE. Predicates\n"
+    "are of the form '<variable-name> <comparator> <value>' where\n"
+    "<comparator> is one of '=', '==', '!=', '<', '>', '<=', '>='.\n"
+    "Coordinate variables are not tested, as by the Python thresholdx.\n"
+    "\n"
+    "Print test results to stdout, prefixed by the file name if more than\n"
+    "one file is given, and exit with success if and only if all tests pass.\n";
+
+enum class op_kind { lt, le, gt, ge, eq, ne };
+
+struct predicate {
+    std::string var;
+    std::string op;
+    op_kind kind;
+    double value;
+};
+
+// Parse '<var> <op> <value>'. Unlike the regex in the Python thresholdx,
+// two-character comparators are matched before their one-character prefixes.
+bool parse_expr(const std::string& e, predicate& p) {
+    static const std::regex re(R"(\s*((?!\d)[\w.]+)\s*(<=|>=|==|!=|<|>|=)\s*(.*))");
+    std::smatch m;
+    if (!std::regex_match(e, m, re)) return false;
+
+    p.var = m[1];
+    p.op = m[2];
+    p.kind = p.op=="<"? op_kind::lt: p.op=="<="? op_kind::le:
+             p.op==">"? op_kind::gt: p.op==">="? op_kind::ge:
+             p.op=="!="? op_kind::ne: op_kind::eq;
+
+    std::string v = m[3];
+    const char* b = v.c_str();
+    char* end = nullptr;
+    p.value = std::strtod(b, &end);
+    if (end==b) return false;
+    while (*end && std::isspace(static_cast<unsigned char>(*end))) ++end;
+    return *end==0;
+}
+
+// Format a double as Python's repr() does, so that output lines match those
+// of the Python thresholdx.
+std::string python_repr(double x) {
+    if (std::isnan(x)) return "nan";
+    if (std::isinf(x)) return x<0? "-inf": "inf";
+
+    // Shortest round-trip digits.
+    char buf[32];
+    for (int prec=0; prec<17; ++prec) {
+        std::snprintf(buf, sizeof(buf), "%.*e", prec, x);
+        if (std::strtod(buf, nullptr)==x) break;
+    }
+
+    std::string s(buf);
+    auto epos = s.find('e');
+    int exponent = std::atoi(s.c_str()+epos+1);
+    std::string mant = s.substr(0, epos);
+
+    bool negative = mant[0]=='-';
+    if (negative) mant.erase(0, 1);
+    std::string digits;
+    for (char c: mant) if (c!='.') digits += c;
+
+    std::string out;
+    if (exponent<-4 || exponent>=16) {
+        out = digits.substr(0, 1);
+        if (digits.size()>1) out += "."+digits.substr(1);
+        char ebuf[16];
+        std::snprintf(ebuf, sizeof(ebuf), "e%c%02d", exponent<0? '-': '+', std::abs(exponent));
+        out += ebuf;
+    }
+    else if (exponent<0) {
+        out = "0."+std::string(-exponent-1, '0')+digits;
+    }
+    else {
+        std::size_t ipart = exponent+1;
+        if (digits.size()<=ipart) {
+            out = digits+std::string(ipart-digits.size(), '0')+".0";
+        }
+        else {
+            out = digits.substr(0, ipart)+"."+digits.substr(ipart);
+        }
+    }
+    return negative? "-"+out: out;
+}
+
+// Running summary of a variable sufficient to decide every predicate on it:
+// 'all(v op c)' for ordering comparisons follows from the extrema, and NaN
+// compares false against everything but '!='.
+struct var_summary {
+    std::uint64_t count = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    bool has_nan = false;
+    std::vector<double> ne_values;  // Values of '!=' predicates.
+    std::vector<char> any_equal;    // Whether some element equals ne_values[i].
+
+    void accumulate(const double* x, std::size_t n) {
+        double lo = min, hi = max;
+        bool nan = false;
+        for (std::size_t i=0; i<n; ++i) {
+            lo = x[i]<lo? x[i]: lo;
+            hi = x[i]>hi? x[i]: hi;
+            nan |= x[i]!=x[i];
+        }
+        min = lo;
+        max = hi;
+        has_nan |= nan;
+
+        for (std::size_t k=0; k<ne_values.size(); ++k) {
+            if (any_equal[k]) continue;
+            const double c = ne_values[k];
+            bool eq = false;
+            for (std::size_t i=0; i<n; ++i) eq |= x[i]==c;
+            any_equal[k] = eq;
+        }
+        count += n;
+    }
+
+    bool test(const predicate& p) const {
+        if (count==0) return true;
+
+        double c = p.value;
+        switch (p.kind) {
+        case op_kind::lt: return !has_nan && max<c;
+        case op_kind::le: return !has_nan && max<=c;
+        case op_kind::gt: return !has_nan && min>c;
+        case op_kind::ge: return !has_nan && min>=c;
+        case op_kind::eq: return !has_nan && min==c && max==c;
+        case op_kind::ne:
+            for (std::size_t k=0; k<ne_values.size(); ++k) {
+                if (ne_values[k]==c) return !any_equal[k];
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+struct file_result {
+    bool success = true;
+    bool error = false;
+    std::string output;
+};
+
+file_result process_file(const std::string& path, const std::vector<predicate>& preds, bool quiet, bool prefix) {
+    file_result result;
+    std::ostringstream out;
+    std::string lead = prefix? path+": ": "";
+
+    try {
+        sup::netcdf_file nc(path);
+
+        // Compile the predicates: one summary per referenced variable.
+        std::map<std::string, var_summary> summaries;
+        for (auto& p: preds) {
+            auto v = nc.find_variable(p.var);
+            if (!v || nc.is_coordinate(*v)) continue;
+            auto& s = summaries[p.var];
+            if (p.kind==op_kind::ne) {
+                s.ne_values.push_back(p.value);
+                s.any_equal.push_back(false);
+            }
+        }
+
+        // One pass over the data of each variable, decoded in blocks that
+        // stay in cache while every predicate is applied.
+        constexpr std::size_t block = 4096;
+        std::vector<double> buf(block);
+        for (auto& kv: summaries) {
+            const auto& var = *nc.find_variable(kv.first);
+            auto& summary = kv.second;
+            const std::size_t tsize = sup::netcdf_file::type_size(var.type);
+
+            nc.for_each_slab(var, [&](const unsigned char* p, std::size_t n) {
+                for (std::size_t i=0; i<n; i+=block) {
+                    std::size_t m = std::min(block, n-i);
+                    sup::decode_be(var.type, p+i*tsize, m, buf.data());
+                    summary.accumulate(buf.data(), m);
+                }
+            });
+        }
+
+        for (auto& p: preds) {
+            auto it = summaries.find(p.var);
+            std::string status;
+            if (it==summaries.end()) {
+                status = "no such variable";
+                result.success = false;
+            }
+            else {
+                bool pass = it->second.test(p);
+                status = pass? "pass": "fail";
+                result.success &= pass;
+            }
+            if (!quiet) {
+                out << lead << p.var << p.op << python_repr(p.value) << ": " << status << "\n";
+            }
+        }
+    }
+    catch (std::exception& e) {
+        result.success = false;
+        result.error = true;
+        out << "unable to open dataset '" << path << "': " << e.what() << "\n";
+    }
+
+    result.output = out.str();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    std::vector<predicate> preds;
+    std::vector<std::string> files;
+    bool quiet = false;
+    unsigned njobs = std::max(1u, std::thread::hardware_concurrency());
+
+    auto usage_error = [](const std::string& msg) {
+        std::cerr << usage_str << "thresholdx-native: error: " << msg << "\n";
+        std::exit(2);
+    };
+
+    for (int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        if (arg=="-h" || arg=="--help") {
+            std::cout << usage_str << help_str;
+            return 0;
+        }
+        else if (arg=="-q") {
+            quiet = true;
+        }
+        else if (arg=="-e" || arg=="-j") {
+            if (i+1>=argc) usage_error("argument "+arg+": expected one argument");
+            std::string value = argv[++i];
+            if (arg=="-j") {
+                njobs = std::max(1, std::atoi(value.c_str()));
+            }
+            else {
+                predicate p;
+                if (!parse_expr(value, p)) usage_error("unable to parse expression '"+value+"'.");
+                preds.push_back(p);
+            }
+        }
+        else if (arg.size()>1 && arg[0]=='-') {
+            usage_error("unrecognized arguments: "+arg);
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+
+    if (preds.empty()) usage_error("the following arguments are required: -e");
+    if (files.empty()) usage_error("the following arguments are required: FILE");
+
+    std::vector<file_result> results(files.size());
+    std::atomic<std::size_t> next(0);
+    bool prefix = files.size()>1;
+
+    auto worker = [&]() {
+        for (std::size_t i; (i = next++)<files.size(); ) {
+            results[i] = process_file(files[i], preds, quiet, prefix);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned j=1; j<std::min<std::size_t>(njobs, files.size()); ++j) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t: threads) t.join();
+
+    bool success = true, error = false;
+    for (auto& r: results) {
+        (r.error? std::cerr: std::cout) << r.output;
+        success &= r.success;
+        error |= r.error;
+    }
+
+    return error? 2: success? 0: 1;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <arbor/simple_sampler.hpp>
+
+// Linear interpolation of a trace, for queries at non-decreasing times.
+// Times outside the trace take the first or last value.
+class trace_interpolator {
+public:
+    explicit trace_interpolator(const arb::trace_data<double>& trace): trace_(&trace) {}
+
+    double operator()(double t) {
+        const auto& tr = *trace_;
+        const auto n = tr.size();
+        while (cursor_<n && tr[cursor_].t<=t) ++cursor_;
+
+        if (cursor_==0) return tr.front().v;
+        if (cursor_==n) return tr.back().v;
+
+        const auto& a = tr[cursor_-1];
+        const auto& b = tr[cursor_];
+        return a.v + (b.v-a.v)*(t-a.t)/(b.t-a.t);
+    }
+
+private:
+    const arb::trace_data<double>* trace_;
+    // Index of the first sample with time greater than the last query.
+    std::size_t cursor_ = 0;
+};
+
+// Times of upward crossings of threshold, interpolated between samples.
+inline std::vector<double> threshold_crossings(const arb::trace_data<double>& trace, double threshold) {
+    std::vector<double> times;
+    for (std::size_t i=1; i<trace.size(); ++i) {
+        const auto& a = trace[i-1];
+        const auto& b = trace[i];
+        if (a.v<threshold && b.v>=threshold) {
+            times.push_back(a.t + (b.t-a.t)*(threshold-a.v)/(b.v-a.v));
+        }
+    }
+    return times;
+}
+
+// Root mean square difference from a reference, interpolated at sample times.
+inline double rms_error(const arb::trace_data<double>& trace, const arb::trace_data<double>& reference) {
+    if (trace.empty() || reference.empty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    trace_interpolator ref(reference);
+    double sum = 0;
+    for (const auto& s: trace) {
+        double d = s.v-ref(s.t);
+        sum += d*d;
+    }
+    return std::sqrt(sum/trace.size());
+}
+
+struct trace_features {
+    double peak_voltage = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> spike_times;
+    double rmse = std::numeric_limits<double>::quiet_NaN();
+};
+
+// Features of a voltage trace; the RMSE is computed only if a non-empty
+// reference is given.
+inline trace_features compute_features(
+    const arb::trace_data<double>& trace, double threshold,
+    const arb::trace_data<double>& reference = {})
+{
+    trace_features f;
+    for (const auto& s: trace) {
+        if (!(s.v<=f.peak_voltage)) f.peak_voltage = s.v;
+    }
+    f.spike_times = threshold_crossings(trace, threshold);
+    if (!reference.empty()) {
+        f.rmse = rms_error(trace, reference);
+    }
+    return f;
+}
+
+// Distance between two spike trains: the mean absolute difference of spike
+// times paired in order, plus penalty for each unpaired spike.
+inline double spike_distance(const std::vector<double>& a, const std::vector<double>& b, double penalty) {
+    std::size_t n = std::min(a.size(), b.size());
+    std::size_t unpaired = std::max(a.size(), b.size())-n;
+
+    double sum = 0;
+    for (std::size_t i=0; i<n; ++i) {
+        sum += std::abs(a[i]-b[i]);
+    }
+    return (n? sum/n: 0.) + penalty*unpaired;
+}
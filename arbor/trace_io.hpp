@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <arbor/sampling.hpp>
+#include <arbor/simple_sampler.hpp>
+
+#include <common/gorilla.hpp>
+#include <common/packed_trace.hpp>
+#include <nlohmann/json.hpp>
+
+// Writes voltage trace as a json file.
+inline void write_trace_json(const arb::trace_data<double>& trace, const std::string& path) {
+    nlohmann::json json;
+    json["name"] = "ring demo";
+    json["units"] = "mV";
+    json["cell"] = "0.0";
+    json["probe"] = "0";
+
+    auto& jt = json["data"]["time"];
+    auto& jy = json["data"]["voltage"];
+
+    for (const auto& sample: trace) {
+        jt.push_back(sample.t);
+        jy.push_back(sample.v);
+    }
+
+    std::ofstream file(path);
+    file << std::setw(1) << json << "\n";
+}
+
+// Writes a voltage trace in the format of write_trace_json incrementally,
+// for runs too long to hold the trace in memory. Times are written to the
+// output as they arrive, and values to a temporary file in TMPDIR, which is
+// copied into the output on close.
+//
+// The output may also be a pipe, as written to by the validate driver; the
+// values are then kept in memory instead, so that nothing but the output
+// is written.
+class trace_json_writer {
+public:
+    explicit trace_json_writer(const std::string& path) {
+        out_.open(path);
+        if (!out_.good()) {
+            throw std::runtime_error("Unable to open trace output file: "+path);
+        }
+        struct stat st;
+        if (::stat(path.c_str(), &st)==0 && S_ISREG(st.st_mode)) {
+            values_path_ = make_temp_file();
+            spool_.open(values_path_);
+            if (!spool_.good()) {
+                std::remove(values_path_.c_str());
+                throw std::runtime_error("Unable to open temporary trace file: "+values_path_);
+            }
+            values_ = &spool_;
+        }
+        out_ << std::setprecision(17);
+        *values_ << std::setprecision(17);
+        out_ << "{\"cell\":\"0.0\",\"name\":\"ring demo\",\"probe\":\"0\",\"units\":\"mV\",\"data\":{\"time\":[";
+    }
+
+    trace_json_writer(const trace_json_writer&) = delete;
+    trace_json_writer& operator=(const trace_json_writer&) = delete;
+
+    ~trace_json_writer() {
+        try { close(); } catch (...) {}
+    }
+
+    void append(const arb::trace_data<double>& trace) {
+        for (const auto& sample: trace) {
+            const char* sep = n_++? ",": "";
+            out_ << sep << sample.t;
+            *values_ << sep << sample.v;
+        }
+    }
+
+    void flush() {
+        out_.flush();
+        values_->flush();
+    }
+
+    void close() {
+        if (!out_.is_open()) return;
+
+        out_ << "],\"voltage\":[";
+        if (values_path_.empty()) {
+            out_ << memory_.str();
+        }
+        else {
+            spool_.close();
+            std::ifstream values(values_path_);
+            out_ << values.rdbuf();
+            values.close();
+            std::remove(values_path_.c_str());
+        }
+        out_ << "]}}\n";
+        out_.close();
+    }
+
+private:
+    std::ofstream out_;
+    std::string values_path_;   // Empty if the values are kept in memory.
+    std::ofstream spool_;
+    std::ostringstream memory_;
+    std::ostream* values_ = &memory_;
+    std::size_t n_ = 0;
+
+    static std::string make_temp_file() {
+        const char* dir = std::getenv("TMPDIR");
+        std::string templ = std::string(dir && *dir? dir: "/tmp")+"/trace-values-XXXXXX";
+        std::vector<char> name(templ.begin(), templ.end());
+        name.push_back(0);
+        int fd = ::mkstemp(name.data());
+        if (fd<0) {
+            throw std::runtime_error("Unable to create temporary trace file: "+templ);
+        }
+        ::close(fd);
+        return name.data();
+    }
+};
+
+// Reads a voltage trace in the format written by write_trace_json,
+// or by test_single.py with the -o option.
+inline arb::trace_data<double> read_trace_json(const std::string& path) {
+    std::ifstream f(path);
+    if (!f.good()) {
+        throw std::runtime_error("Unable to open trace file: "+path);
+    }
+
+    nlohmann::json json;
+    json << f;
+
+    const auto& jt = json.at("data").at("time");
+    const auto& jy = json.at("data").at("voltage");
+    if (jt.size()!=jy.size()) {
+        throw std::runtime_error("Time and voltage sizes differ in trace file: "+path);
+    }
+
+    arb::trace_data<double> trace;
+    trace.reserve(jt.size());
+    for (std::size_t i=0; i<jt.size(); ++i) {
+        trace.push_back({jt[i].get<double>(), jy[i].get<double>()});
+    }
+    return trace;
+}
+
+// Sampler that feeds samples straight into a streaming gorilla encoder.
+// The encoder must outlive the simulation it is attached to.
+inline arb::sampler_function make_gorilla_sampler(sup::gorilla_encoder& encoder) {
+    return [&encoder](arb::cell_member_type, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+        for (std::size_t i=0; i<n; ++i) {
+            if (auto p = arb::util::any_cast<const double*>(recs[i].data)) {
+                encoder.append(recs[i].time, *p);
+            }
+        }
+    };
+}
+
+// Sampler that stores samples at reduced precision in a packed trace.
+// The trace must outlive the simulation it is attached to.
+inline arb::sampler_function make_packed_sampler(sup::packed_trace& trace) {
+    return [&trace](arb::cell_member_type, arb::probe_tag, std::size_t n, const arb::sample_record* recs) {
+        for (std::size_t i=0; i<n; ++i) {
+            if (auto p = arb::util::any_cast<const double*>(recs[i].data)) {
+                trace.append(recs[i].time, p);
+            }
+        }
+    };
+}
+
+// Reads a voltage trace in json, gorilla compressed or packed format; of a
+// packed trace, the first column.
+inline arb::trace_data<double> read_trace(const std::string& path) {
+    std::vector<double> t, v;
+    if (sup::is_gorilla_file(path)) {
+        sup::read_gorilla_file(path, t, v);
+    }
+    else if (sup::is_packed_trace(path)) {
+        std::vector<std::vector<double>> columns;
+        sup::read_packed_trace(path, t, columns);
+        if (columns.empty()) {
+            throw std::runtime_error("No columns in trace file: "+path);
+        }
+        v = std::move(columns.front());
+    }
+    else {
+        return read_trace_json(path);
+    }
+
+    arb::trace_data<double> trace;
+    trace.reserve(t.size());
+    for (std::size_t i=0; i<t.size(); ++i) {
+        trace.push_back({t[i], v[i]});
+    }
+    return trace;
+}
@@ -0,0 +1,150 @@
+/*
+ * Decode a gorilla compressed or packed trace, or one run of a trace archive,
+ * written by single into the json trace format used by the comparison tools.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <common/gorilla.hpp>
+#include <common/packed_trace.hpp>
+#include <common/trace_archive.hpp>
+#include <nlohmann/json.hpp>
+
+const char* usage_str =
+    "usage: tracedump [-h] [-o FILE] [--from T0] [--to T1] [--run ID | --list] TRACE\n"
+    "\n"
+    "Decode the gorilla compressed or packed trace TRACE, or the run with id\n"
+    "ID of the trace archive TRACE, optionally restricted to sample times in\n"
+    "[T0, T1), and write it as json to FILE or stdout. Of a packed trace, the\n"
+    "first column is written, along with its metadata. With --list, print the\n"
+    "run id, parameter hash, and sample and spike counts of each archived run.\n";
+
+int main(int argc, char** argv) {
+    std::string input, output;
+    long long run_id = -1;
+    bool list = false;
+    double t0 = -std::numeric_limits<double>::infinity();
+    double t1 = std::numeric_limits<double>::infinity();
+
+    for (int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i+1<argc;
+        if (arg=="-h" || arg=="--help") {
+            std::cout << usage_str;
+            return 0;
+        }
+        else if (arg=="-o" && has_value) {
+            output = argv[++i];
+        }
+        else if (arg=="--from" && has_value) {
+            t0 = std::atof(argv[++i]);
+        }
+        else if (arg=="--to" && has_value) {
+            t1 = std::atof(argv[++i]);
+        }
+        else if (arg=="--run" && has_value) {
+            run_id = std::atoll(argv[++i]);
+        }
+        else if (arg=="--list") {
+            list = true;
+        }
+        else if (input.empty() && arg[0]!='-') {
+            input = arg;
+        }
+        else {
+            std::cerr << usage_str;
+            return 2;
+        }
+    }
+    if (input.empty()) {
+        std::cerr << usage_str;
+        return 2;
+    }
+
+    try {
+        const bool is_archive = sup::is_trace_archive(input);
+        if (is_archive && list) {
+            sup::trace_archive archive(input);
+            for (std::size_t i=0; i<archive.num_runs(); ++i) {
+                auto run = archive.run(i);
+                std::cout << run.run_id << " " << std::hex << std::setw(16) << std::setfill('0')
+                          << run.param_hash << std::dec << std::setfill(' ') << " "
+                          << run.num_samples << " " << run.num_spikes << "\n";
+            }
+            return 0;
+        }
+        if (is_archive!=(run_id>=0) || list) {
+            throw std::runtime_error(is_archive? "trace archive requires --run or --list": "not a trace archive");
+        }
+
+        nlohmann::json json;
+        json["name"] = "ring demo";
+        json["units"] = "mV";
+        json["cell"] = "0.0";
+        json["probe"] = "0";
+
+        auto& jt = json["data"]["time"];
+        auto& jy = json["data"]["voltage"];
+        jt = nlohmann::json::array();
+        jy = nlohmann::json::array();
+
+        if (is_archive) {
+            sup::trace_archive archive(input);
+            auto run = archive.find(run_id).window(t0, t1);
+            for (std::size_t i=0; i<run.num_samples; ++i) {
+                jt.push_back(run.times[i]);
+                jy.push_back(run.values[i]);
+            }
+
+            auto& js = json["spikes"];
+            js = nlohmann::json::array();
+            for (std::size_t i=0; i<run.num_spikes; ++i) {
+                js.push_back({run.spikes[i].gid, run.spikes[i].time});
+            }
+        }
+        else if (sup::is_packed_trace(input)) {
+            std::vector<double> times;
+            std::vector<std::vector<double>> columns;
+            json["packed"] = sup::read_packed_trace(input, times, columns);
+            for (std::size_t i=0; i<times.size() && !columns.empty(); ++i) {
+                if (times[i]>=t0 && times[i]<t1) {
+                    jt.push_back(times[i]);
+                    jy.push_back(columns[0][i]);
+                }
+            }
+        }
+        else {
+            std::ifstream f(input, std::ios::binary);
+            if (!f.good()) {
+                throw std::runtime_error("unable to open file");
+            }
+            std::vector<unsigned char> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+            sup::gorilla_decode(buf.data(), buf.size(),
+                [&](double t, double v) {
+                    jt.push_back(t);
+                    jy.push_back(v);
+                }, t0, t1);
+        }
+
+        if (output.empty()) {
+            std::cout << std::setw(1) << json << "\n";
+        }
+        else {
+            std::ofstream file(output);
+            file << std::setw(1) << json << "\n";
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << "tracedump: " << input << ": " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+:  Gap junction half: the current into this side of a junction of
+:  conductance g with the membrane whose voltage vgap points to
+
+NEURON {
+    POINT_PROCESS Gap
+    POINTER vgap
+    RANGE g, i
+    NONSPECIFIC_CURRENT i
+}
+
+PARAMETER {
+    g = 0.001 (uS)
+}
+
+ASSIGNED {
+    v (mV)
+    vgap (mV)
+    i (nA)
+}
+
+BREAKPOINT {
+    i = g*(v - vgap)
+}
@@ -3,15 +3,24 @@
 from neuron import h
 import numpy as np
 import time as cookie
-import pylab as plt
+import argparse
 import pickle
 import json
+import math
 import sys
 
-with open(sys.argv[1]) as json_file:
-    in_param = json.load(json_file)
+P = argparse.ArgumentParser(description='Simulate the single cell validation model.')
+P.add_argument('params', metavar='FILE', help='input parameter file')
+P.add_argument('-o', '--output', metavar='FILE', dest='output', help='write voltage trace as json to FILE instead of plotting')
+P.add_argument('-d', '--dendrite', metavar='FILE', dest='dendrite', help='write the voltage at each dendrite segment as a dendrite matrix to FILE')
+P.add_argument('-i', '--input-file', metavar='FILE', dest='input_file', help='spike train file in place of the input_file parameter, as a path from the current directory')
+P.add_argument('-n', '--cells', metavar='N', dest='cells', type=int, help='number of cells in gap mode (default: largest of the gap sizes)')
+opts = P.parse_args()
 
-np.random.seed(149)
+with open(opts.params) as json_file:
+    in_param = json.load(json_file)
+if opts.input_file:
+    in_param["input_file"] = opts.input_file
 
 h.load_file("stdrun.hoc")
 h.load_file("cell.hoc")
@@ -20,79 +29,224 @@ h.load_file("cell.hoc")
 # Creating cells #
 ##################
 
-cell = h.mkcell()
-if in_param["syn_seg"] == 0 :
-    syn = h.Exp2Syn(cell.soma(in_param["syn_loc"]))
-else :
-    syn = h.Exp2Syn(cell.dend(in_param["syn_loc"]))
-
-syn.tau1 = in_param["tau1_syn"]
-syn.tau2 = in_param["tau2_syn"]
-syn.e = in_param["e_syn"]
-
-if in_param["soma_hh"] :
-    cell.soma.insert("hh")
-    cell.soma.ena = in_param["hh_ena"]
-    cell.soma.ek = in_param["hh_ek"]
-    cell.soma.gnabar_hh = in_param["hh_gnabar"]
-    cell.soma.gkbar_hh = in_param["hh_gkbar"]
-    cell.soma.gl_hh = in_param["hh_gl"]
-else :
-    cell.soma.insert("pas")
-    cell.soma.e_pas = in_param["pas_e"]
-    cell.soma.g_pas = in_param["pas_g"]
-
-if in_param["dend_hh"] :
-    cell.dend.insert("hh")
-    cell.dend.ena = in_param["hh_ena"]
-    cell.dend.ek = in_param["hh_ek"]
-    cell.dend.gnabar_hh = in_param["hh_gnabar"]
-    cell.dend.gkbar_hh = in_param["hh_gkbar"]
-    cell.dend.gl_hh = in_param["hh_gl"]
-else :
-    cell.dend.insert("pas")
-    cell.dend.e_pas = in_param["pas_e"]
-    cell.dend.g_pas = in_param["pas_g"]
+def make_cell():
+    cell = h.mkcell()
+    cell.dend.nseg = in_param.get("dend_compartments", 2000)
+
+    if in_param["soma_hh"] :
+        cell.soma.insert("hh")
+        cell.soma.ena = in_param["hh_ena"]
+        cell.soma.ek = in_param["hh_ek"]
+        cell.soma.gnabar_hh = in_param["hh_gnabar"]
+        cell.soma.gkbar_hh = in_param["hh_gkbar"]
+        cell.soma.gl_hh = in_param["hh_gl"]
+    else :
+        cell.soma.insert("pas")
+        cell.soma.e_pas = in_param["pas_e"]
+        cell.soma.g_pas = in_param["pas_g"]
+
+    if in_param["dend_hh"] :
+        cell.dend.insert("hh")
+        cell.dend.ena = in_param["hh_ena"]
+        cell.dend.ek = in_param["hh_ek"]
+        cell.dend.gnabar_hh = in_param["hh_gnabar"]
+        cell.dend.gkbar_hh = in_param["hh_gkbar"]
+        cell.dend.gl_hh = in_param["hh_gl"]
+    else :
+        cell.dend.insert("pas")
+        cell.dend.e_pas = in_param["pas_e"]
+        cell.dend.g_pas = in_param["pas_g"]
+
+    return cell
+
+def make_synapse(cell):
+    if in_param["syn_seg"] == 0 :
+        syn = h.Exp2Syn(cell.soma(in_param["syn_loc"]))
+    else :
+        syn = h.Exp2Syn(cell.dend(in_param["syn_loc"]))
+
+    syn.tau1 = in_param["tau1_syn"]
+    syn.tau2 = in_param["tau2_syn"]
+    syn.e = in_param["e_syn"]
+    return syn
+
+# In gap mode, a chain or lattice of the largest of the sizes, or of
+# --cells cells, coupled by gap junctions between their dendrites as in
+# the Arbor gap mode; the first "stimulated" cells get the input.
+gap = in_param.get("gap", {}) if in_param.get("mode") == "gap" else None
+if gap is None:
+    ncells = 1
+    nstim = 1
+else:
+    ncells = opts.cells or max(gap.get("sizes", [2, 4, 8, 16, 32, 64]))
+    nstim = gap.get("stimulated", 1)
+
+cells = [make_cell() for _ in range(ncells)]
+cell = cells[0]
+syns = [make_synapse(c) for c in cells[:nstim]]
+
+gaps = []
+if gap is not None:
+    width = gap.get("width", 8) if gap.get("topology", "chain") == "lattice" else ncells
+    loc = gap.get("location", 1.0)
+
+    def couple(a, b):
+        for x, y in ((a, b), (b, a)):
+            g = h.Gap(cells[x].dend(loc))
+            g.g = gap.get("ggap", 0.001)
+            h.setpointer(cells[y].dend(loc)._ref_v, 'vgap', g)
+            gaps.append(g)
+
+    for i in range(ncells):
+        if i % width + 1 < width and i + 1 < ncells:
+            couple(i, i + 1)
+        if i + width < ncells:
+            couple(i, i + width)
 
 ################################
 # Create spike times for input #
 ################################
-tstop = 200 # unts: ms
-frequency = 5 # units: Hz
+tstop = in_param.get("tstop", 200) # unts: ms
+
+M32 = 0xffffffff
+M64 = 0xffffffffffffffff
+
+def seed_seq(v, n):
+    # The n words of std::seed_seq{v...}.generate.
+    b = [0x8b8b8b8b]*n
+    s = len(v)
+    t = 11 if n >= 623 else 7 if n >= 68 else 5 if n >= 39 else 3 if n >= 7 else (n-1)//2
+    p = (n-t)//2
+    q = p+t
+    m = max(s+1, n)
+    T = lambda x: x ^ (x >> 27)
+    for k in range(m):
+        r1 = 1664525*T(b[k%n] ^ b[(k+p)%n] ^ b[(k-1)%n]) & M32
+        r2 = (r1 + (s if k == 0 else k%n + v[k-1] if k <= s else k%n)) & M32
+        b[(k+p)%n] = (b[(k+p)%n] + r1) & M32
+        b[(k+q)%n] = (b[(k+q)%n] + r2) & M32
+        b[k%n] = r2
+    for k in range(m, m+n):
+        r3 = 1566083941*T((b[k%n] + b[(k+p)%n] + b[(k-1)%n]) & M32) & M32
+        r4 = (r3 - k%n) & M32
+        b[(k+p)%n] ^= r3
+        b[(k+q)%n] ^= r4
+        b[k%n] = r4
+    return b
+
+class mt19937_64:
+    # std::mt19937_64 seeded from a std::seed_seq.
+    def __init__(self, seeds):
+        w = seed_seq([x & M32 for x in seeds], 624)
+        self.x = [w[2*i] | w[2*i+1] << 32 for i in range(312)]
+        self.i = 312
+
+    def __call__(self):
+        if self.i == 312:
+            x = self.x
+            for k in range(312):
+                y = (x[k] & ~0x7fffffff & M64) | (x[(k+1)%312] & 0x7fffffff)
+                x[k] = x[(k+156)%312] ^ (y >> 1) ^ (0xb5026f5aa96619e9 if y & 1 else 0)
+            self.i = 0
+        z = self.x[self.i]
+        self.i += 1
+        z ^= (z >> 29) & 0x5555555555555555
+        z ^= (z << 17) & 0x71d67fffeda60000
+        z ^= (z << 37) & 0xfff7eee000000000
+        return z ^ (z >> 43)
+
+def input_times(inp, seed_gid):
+    # The events of one entry of "inputs" before tstop, as Arbor's Poisson
+    # and regular schedules make them in arbor/input_generators.hpp: Poisson
+    # intervals from std::exponential_distribution over std::mt19937_64
+    # seeded by (seed, gid, target), or the multiples of the period from start.
+    start = inp.get("start", 0)
+    stop = min(inp.get("stop", float("inf")), tstop)
+    rate = inp.get("rate", 10)
+    times = []
+    if inp.get("type", "poisson") == "poisson":
+        rng = mt19937_64([inp.get("seed", 1), seed_gid, inp.get("target", 0)])
+        lam = rate/1000
+        def interval():
+            u = min(float(rng())/2.0**64, math.nextafter(1, 0))
+            return -math.log(1 - u)/lam
+        t = start + interval()
+        while t < stop:
+            times.append(t)
+            t += interval()
+    else:
+        dt = 1000/rate
+        n = int(start/dt)
+        while n*dt < start:
+            n += 1
+        while n*dt < stop:
+            times.append(n*dt)
+            n += 1
+    return times
+
+def file_times(path, gid):
+    # The trains of gid in a spike train file, in the layout of
+    # common/cpp/include/common/spike_trains.hpp, by target.
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:8] != b'SPKTRN01':
+        raise ValueError('not a spike train file: ' + path)
+    n = int(np.frombuffer(data, '<u8', 1, 8)[0])
+    index = np.frombuffer(data, [('gid', '<u4'), ('target', '<u4'), ('first', '<u8'), ('last', '<u8')], n, 16)
+    times = np.frombuffer(data, '<f8', offset=16+24*n)
+    return [(int(e['target']), times[e['first']:e['last']].tolist()) for e in index if e['gid'] == gid]
+
+# The trains of each stimulated cell: (target, times, weight). Cells that
+# are the same gid in Arbor get the same inputs.
+def trains_of(gid):
+    if in_param.get("input_file"):
+        trains = [(tgt, ts, in_param["weight"]) for tgt, ts in file_times(in_param["input_file"], gid)]
+    elif in_param.get("inputs"):
+        trains = [(i.get("target", 0), input_times(i, gid), i.get("weight", in_param["weight"]))
+                  for i in in_param["inputs"]]
+    else:
+        return None
+    for tgt, _, _ in trains:
+        if tgt != 0:
+            raise ValueError('inputs: no target {} on gid {}'.format(tgt, gid))
+    return trains
+
+# Without an input_file or inputs, the fixed input events of Arbor's
+# input_event_times() in arbor/single_recipe.hpp, whatever tstop: the 5 Hz
+# Poisson train of numpy seed 149 up to 200 ms.
+input_event_times = [
+    25.269724183039855, 29.37076391451496,
+    58.472477010286546, 93.80268485203328,
+    112.71090127018375, 142.6472406502223
+]
 
 vecstims = h.VecStim()
-evecs = h.Vector()
-vec = []
-
-intervals = []
-mu = 1000./frequency # Convert to ms
-elapsed_time = 0
-flag = 1
-while flag:
-    roll = np.random.uniform(0,1)
-    interval = -mu*np.log(roll)
-        
-    intervals.append(interval)
-    elapsed_time += interval
-        
-    if elapsed_time > tstop:
-        flag = 0
-        spikes = np.cumsum(intervals)[:-1]
-        for spike in spikes:
-            evecs.append(spike)
-            vec.append(spike)
-           
-        vecstims.play(evecs)
-
-for v in vec:
-    print v
+evecs = h.Vector(input_event_times)
+vecstims.play(evecs)
+
+for v in input_event_times:
+    print(v)
 
 #####################
 # Connecting inputs #
 #####################
-nc = h.NetCon(vecstims, syn)
-nc.weight[0] = in_param["weight"]
-nc.delay = 0
+ncs = []
+stims = []
+for gid, syn in enumerate(syns):
+    trains = trains_of(gid)
+    if trains is None:
+        trains = [(0, None, in_param["weight"])]
+    for _, ts, weight in trains:
+        src = vecstims
+        if ts is not None:
+            src = h.VecStim()
+            tv = h.Vector(ts)
+            src.play(tv)
+            stims.append((src, tv))
+        nc = h.NetCon(src, syn)
+        nc.weight[0] = weight
+        nc.delay = 0
+        ncs.append(nc)
 
 ################################
 # Setting up vectors to record #
@@ -100,9 +254,23 @@ nc.delay = 0
 v = h.Vector()
 v.record(cell.soma(0.5)._ref_v)
 
+if ncells > 1:
+    v_last = h.Vector()
+    v_last.record(cells[-1].soma(0.5)._ref_v)
+
 t = h.Vector()
 t.record(h._ref_t)
 
+# Voltage at the centre of each dendrite segment, for comparison with
+# single --dendrite by dendcompare.
+if opts.dendrite:
+    dend_x = [seg.x for seg in cell.dend]
+    dend_v = []
+    for x in dend_x:
+        dv = h.Vector()
+        dv.record(cell.dend(x)._ref_v)
+        dend_v.append(dv)
+
 #########################
 # Setting up simulation #
 #########################
@@ -125,10 +293,48 @@ h.run()
 ET = cookie.time()-ST
 print("Finished in %f seconds" % ET)
 
-########
-# Plot #
-########
-_=plt.plot(t,v)
-_=plt.xlabel('Time (ms)')
-_=plt.ylabel('Somatic Voltage (mV)')
-plt.show()
+##########
+# Output #
+##########
+if opts.dendrite:
+    # The dendrite matrix layout of common/cpp/include/common/dendrite_matrix.hpp:
+    # magic, metadata length and json, then rows of time and float32 values,
+    # each padded to 8 bytes.
+    meta = json.dumps({'positions': dend_x, 'units': 'mV'}).encode()
+    meta += b'\0'*(-len(meta)%8)
+    npos = len(dend_x)
+    row = np.dtype([('time', '<f8'), ('values', '<f4', (npos,)), ('pad', 'V{}'.format(-4*npos%8))])
+    rows = np.zeros(len(t), dtype=row)
+    rows['time'] = np.array(t)
+    for i, dv in enumerate(dend_v):
+        rows['values'][:, i] = np.array(dv)
+    with open(opts.dendrite, 'wb') as f:
+        f.write(b'DNDMTX01')
+        f.write(np.uint64(len(meta)).tobytes())
+        f.write(meta)
+        rows.tofile(f)
+
+if opts.output:
+    def trace_of(name, gid, vec):
+        return {
+            'name': name,
+            'units': 'mV',
+            'cell': '{}.0'.format(gid),
+            'probe': '0',
+            'data': {'time': list(t), 'voltage': list(vec)}
+        }
+    if gap is None:
+        out = trace_of('neuron single', 0, v)
+    else:
+        # A list of the first and last cell traces, as written by Arbor.
+        out = [trace_of('neuron gap', 0, v)]
+        if ncells > 1:
+            out.append(trace_of('neuron gap', ncells-1, v_last))
+    with open(opts.output, 'w') as f:
+        json.dump(out, f)
+else:
+    import pylab as plt
+    _=plt.plot(t,v)
+    _=plt.xlabel('Time (ms)')
+    _=plt.ylabel('Somatic Voltage (mV)')
+    plt.show()